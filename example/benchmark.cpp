@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+// The decoders aren't part of the library interface, their internal header is included to time them directly
+#include "BDParserDecoders.hpp"
+
+// Opens every playlist once, then times only the decoding from the open readers, through the concrete
+// reader type and through IReader& as the decoders were called before they were templated
+template<typename Reader>
+static bool run(const std::vector<std::string>& playlist_paths, const std::shared_ptr<const std::string>& root_path, int iterations, std::string_view name)
+{
+	std::vector<std::unique_ptr<Reader>> readers;
+	for (const auto& playlist_path : playlist_paths) {
+		std::error_code ec = {};
+		auto reader = std::make_unique<Reader>(playlist_path, ec);
+		if (!ec) {
+			readers.emplace_back(std::move(reader));
+		}
+	}
+	if (readers.empty()) {
+		return false;
+	}
+
+	const parser::BDParser::options_t options = {};
+
+	std::size_t decoded = {};
+	auto measure = [&](auto&& decode) {
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			for (auto& reader : readers) {
+				std::error_code ec = {};
+				reader->seek(0, ec);
+
+				parser::BDParser::playlist_t playlist;
+				decoded += decode(*reader, playlist);
+			}
+		}
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+		return elapsed.count() / (static_cast<double>(iterations) * readers.size());
+	};
+
+	const auto direct = measure([&](Reader& reader, parser::BDParser::playlist_t& playlist) {
+		return parser::read_playlist(reader, root_path, options, playlist);
+	});
+	const auto type_erased = measure([&](parser::IReader& reader, parser::BDParser::playlist_t& playlist) {
+		return parser::read_playlist(reader, root_path, options, playlist);
+	});
+
+	std::cout << std::format("    {:<6} : {:.2f} us per playlist, {:.2f} us through IReader ({} decoded)\n", name, direct, type_erased, decoded);
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2 && argc != 3) {
+		std::cout << "Usage : Benchmark <path_to_root_BD/BDMV> [iterations]" << std::endl;
+		return -1;
+	}
+
+	const int iterations = argc == 3 ? std::max(std::atoi(argv[2]), 1) : 100;
+
+	// The same playlist files parse() reads
+	std::vector<parser::playlist_file_t> playlist_files;
+	std::ignore = parser::collect_playlists(argv[1], playlist_files);
+
+	std::vector<std::string> playlist_paths;
+	for (auto& playlist_file : playlist_files) {
+		playlist_paths.emplace_back(std::move(playlist_file.path));
+	}
+	if (playlist_paths.empty()) {
+		std::cout << "No playlists found" << std::endl;
+		return -1;
+	}
+
+	const auto root_path = std::make_shared<const std::string>(argv[1]);
+
+	std::cout << std::format("{} playlists, {} iterations\n", playlist_paths.size(), iterations);
+	if (!run<parser::StreamReader>(playlist_paths, root_path, iterations, "stream") ||
+			!run<parser::BufferReader>(playlist_paths, root_path, iterations, "buffer") ||
+			!run<parser::MmapReader>(playlist_paths, root_path, iterations, "mmap")) {
+		std::cout << "The playlists couldn't be opened" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -14,29 +14,59 @@ static std::string pts_to_string(parser::pts_t pts)
 
 int main(int argc, char** argv)
 {
-	if (argc != 2) {
-		std::cout << "Usage : Sample <path_to_root_BD/BDMV>" << std::endl;
+	if (argc != 2 && argc != 3) {
+		std::cout << "Usage : Sample <path_to_root_BD/BDMV> [stream|buffer|mmap]" << std::endl;
 		return -1;
 	}
 
+	parser::BDParser::options_t options;
+	options.skip_playlist_duplicate = true;
+	options.threads = 0;
+	options.fingerprint = true;
+	if (argc == 3) {
+		const std::string_view reader = argv[2];
+		if (reader == "stream") {
+			options.reader_type = parser::ReaderType::Stream;
+		} else if (reader == "mmap") {
+			options.reader_type = parser::ReaderType::Mmap;
+		}
+	}
+
 	parser::BDParser parser;
-	if (!parser.parse(argv[1], true, false)) {
+	if (!parser.parse(argv[1], options)) {
 		std::cout << "Doesn't look like a valid BD/BDMV path or the files are corrupted" << std::endl;
 		return -1;
 	}
 
+	std::cout << std::format("Disc fingerprint : {:016x}\n", parser.fingerprint());
+	if (parser.raw_duplicates()) {
+		std::cout << std::format("Skipped byte-identical playlists : {}\n", parser.raw_duplicates());
+	}
+
 	auto& playlists = parser.playlists();
 	for (const auto& playlist : playlists) {
 		std::cout << std::format("\nPlaylist : {}, duration : {}\n", playlist.mpls_file_name, pts_to_string(playlist.duration));
 		std::cout << std::format("    List of files:\n");
 		for (const auto& item : playlist.items) {
-			std::cout << std::format("        Filename : {}\n", item.file_name);
+			std::cout << std::format("        Filename : {}\n", item.file_name());
+			for (const auto angle_clip_id : playlist.angle_clips(item)) {
+				std::cout << std::format("            Angle : {:05}.M2TS\n", angle_clip_id);
+			}
 		}
 
 		std::cout << std::format("    List of streams:\n");
 		for (const auto& stream : playlist.streams) {
 			std::cout << std::format("        {}\n", stream);
 		}
+
+		if (!playlist.marks.empty()) {
+			std::cout << std::format("    List of chapters:\n");
+			for (const auto& mark : playlist.marks) {
+				if (mark.type == parser::MarkType::Entry) {
+					std::cout << std::format("        {}\n", pts_to_string(mark.time));
+				}
+			}
+		}
 	}
 
 	return 0;
@@ -1,343 +1,510 @@
-﻿#include <fstream>
+﻿#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "BDParser.hpp"
+#include "BDParserDecoders.hpp"
 
 namespace parser {
-	namespace string {
-		[[nodiscard]] static bool ends_with(const std::string& str, const std::string_view suffix) noexcept
-		{
-			return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
-		}
-	}
-
-	[[nodiscard]] static uint16_t swap_uint16(uint16_t value) noexcept
+	class BufferWriter final
 	{
-		return (value << 8) | (value >> 8);
-	}
-
-	[[nodiscard]] static uint32_t swap_uint32(uint32_t value) noexcept
-	{
-		value = ((value << 8) & 0xFF00FF00) | ((value >> 8) & 0xFF00FF);
-		return (value << 16) | (value >> 16);
-	}
+		std::vector<uint8_t> buffer_;
 
-	class IReader {
 	public:
-		IReader() = default;
-		IReader(IReader&&) = delete;
-		IReader(const IReader&) = delete;
-		IReader& operator=(IReader&&) = delete;
-		IReader& operator=(const IReader&) = delete;
-		virtual ~IReader() = default;
-
-		[[nodiscard]] virtual bool open(const std::string& path) = 0;
-		virtual void read_buffer(char* buffer, std::size_t size, std::error_code& ec) = 0;
-		[[nodiscard]] virtual uint32_t read_uint32(std::error_code& ec) = 0;
-		[[nodiscard]] virtual uint16_t read_uint16(std::error_code& ec) = 0;
-		[[nodiscard]] virtual uint8_t read_uint8(std::error_code& ec) = 0;
-		virtual void skip(std::size_t size, std::error_code& ec) = 0;
-		virtual void seek(std::size_t pos, std::error_code& ec) = 0;
-		[[nodiscard]] virtual size_t position(std::error_code& ec) = 0;
-	};
+		[[nodiscard]] const std::vector<uint8_t>& buffer() const noexcept {
+			return buffer_;
+		}
 
-	class StreamReader final : public IReader
-	{
-		std::ifstream stream_;
+		void write_buffer(const char* buffer, std::size_t size) {
+			buffer_.insert(buffer_.end(), buffer, buffer + size);
+		}
 
-	public:
-		explicit StreamReader(const std::string& path, std::error_code& ec) {
-			if (!open(path)) {
-				ec = std::make_error_code(std::io_errc::stream);
-			}
+		void write_uint64(uint64_t value) {
+			write_uint32(static_cast<uint32_t>(value >> 32));
+			write_uint32(static_cast<uint32_t>(value));
 		}
 
-		[[nodiscard]] bool open(const std::string& path) override {
-			stream_.open(path, std::ios::in | std::ios::binary);
-			return stream_.is_open();
+		void write_uint32(uint32_t value) {
+			write_uint16(static_cast<uint16_t>(value >> 16));
+			write_uint16(static_cast<uint16_t>(value));
 		}
 
-		void read_buffer(char* buffer, std::size_t size, std::error_code& ec) noexcept override {
-			stream_.read(buffer, size);
-			if (stream_.fail()) {
-				ec = std::make_error_code(std::io_errc::stream);
-			}
+		void write_uint16(uint16_t value) {
+			write_uint8(static_cast<uint8_t>(value >> 8));
+			write_uint8(static_cast<uint8_t>(value));
 		}
 
-		[[nodiscard]] uint32_t read_uint32(std::error_code& ec) noexcept override {
-			uint32_t value = {};
-			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
-			if (ec) {
-				return {};
-			}
+		void write_uint8(uint8_t value) {
+			buffer_.push_back(value);
+		}
+	};
+
+	// Source packets are 192 bytes, a 4 byte header followed by a TS packet
+	constexpr uint64_t source_packet_size = 192;
 
-			return swap_uint32(value);
+	static void write_varint(std::vector<uint8_t>& data, uint32_t value)
+	{
+		while (value >= 0x80) {
+			data.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
 		}
+		data.push_back(static_cast<uint8_t>(value));
+	}
 
-		[[nodiscard]] uint16_t read_uint16(std::error_code& ec) noexcept override {
-			uint16_t value = {};
-			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
-			if (ec) {
-				return {};
+	[[nodiscard]] static uint32_t read_varint(const uint8_t*& data) noexcept
+	{
+		uint32_t value = {};
+		for (int shift = 0; ; shift += 7) {
+			const auto byte = *data++;
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) {
+				return value;
 			}
+		}
+	}
 
-			return swap_uint16(value);
+	// Adds an entry point to the compact EP map, entries must come in PTS order
+	static void add_entry_point(BDParser::clip_info_t& clip_info, uint32_t pts, uint32_t spn, uint32_t& last_pts, uint32_t& last_spn)
+	{
+		if (clip_info.ep_count % BDParser::clip_info_t::ep_block_size == 0) {
+			clip_info.ep_anchors.push_back({ pts, spn, static_cast<uint32_t>(clip_info.ep_deltas.size()) });
+		} else {
+			write_varint(clip_info.ep_deltas, pts - last_pts);
+			write_varint(clip_info.ep_deltas, spn - last_spn);
 		}
 
-		[[nodiscard]] uint8_t read_uint8(std::error_code& ec) noexcept override {
-			uint8_t value = {};
-			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
-			return value;
+		last_pts = pts;
+		last_spn = spn;
+		clip_info.ep_count++;
+	}
+
+	// Streams of all program sequences of a clip, a PID is listed once
+	template<typename Reader>
+	[[nodiscard]] static bool read_program_info(Reader& reader, uint32_t program_info_address, BDParser::clip_info_t& clip_info)
+	{
+		std::error_code ec = {};
+		reader.seek(program_info_address, ec);
+		const auto length = reader.read_uint32(ec);
+		if (ec) {
+			return false;
 		}
 
-		void skip(std::size_t size, std::error_code& ec) noexcept override {
-			stream_.seekg(size, std::ios_base::cur);
-			if (stream_.fail()) {
-				ec = std::make_error_code(std::io_errc::stream);
-			}
+		if (!length) {
+			return true;
 		}
 
-		void seek(std::size_t pos, std::error_code& ec) noexcept override {
-			stream_.seekg(pos);
-			if (stream_.fail()) {
-				ec = std::make_error_code(std::io_errc::stream);
-			}
+		reader.skip(1, ec);
+		const auto number_of_program_sequences = reader.read_uint8(ec);
+		if (ec) {
+			return false;
 		}
 
-		size_t position(std::error_code& ec) noexcept override {
-			auto position = stream_.tellg();
-			if (stream_.fail()) {
-				ec = std::make_error_code(std::io_errc::stream);
+		pid_set_t pids;
+		for (uint8_t i = 0; i < number_of_program_sequences; i++) {
+			// SPN_program_sequence_start and program_map_PID
+			reader.skip(6, ec);
+			const auto number_of_streams = reader.read_uint8(ec);
+			reader.skip(1, ec);
+			if (ec) {
+				return false;
 			}
 
-			return position;
+			for (uint8_t j = 0; j < number_of_streams; j++) {
+				BDParser::stream_t s;
+				s.pid = reader.read_uint16(ec);
+				const auto size = reader.read_uint8(ec);
+				const auto pos = reader.position(ec);
+				if (ec) {
+					return false;
+				}
+
+				if (!pids[s.pid & pid_mask]) {
+					if (!read_stream_coding_info(reader, s)) {
+						return false;
+					}
+
+					// Unlike the STN table, the clip has the aspect ratio after the video format
+					if (s.format() == StreamFormat::Video) {
+						s.aspect_ratio = static_cast<decltype(s.aspect_ratio)>(reader.read_uint8(ec) >> 4);
+					}
+
+					pids.set(s.pid & pid_mask);
+					clip_info.streams.emplace_back(s);
+				}
+
+				reader.seek(pos + size, ec);
+				if (ec) {
+					return false;
+				}
+			}
 		}
-	};
 
-	static void read_lang_code(IReader& reader, BDParser::stream_t& s, std::error_code& ec)
-	{
-		s.lang_code.resize(3);
-		reader.read_buffer(s.lang_code.data(), 3, ec);
+		return true;
 	}
 
-	[[nodiscard]] static bool read_stream_info(IReader& reader, std::vector<BDParser::stream_t>& streams)
+	template<typename Reader>
+	[[nodiscard]] static bool read_clip_info(Reader& reader, BDParser::clip_info_t& clip_info)
 	{
 		std::error_code ec = {};
-		auto size = reader.read_uint8(ec);
-		auto pos = reader.position(ec);
 
-		auto stream_type = reader.read_uint8(ec);
+		char buffer[4] = {};
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || std::memcmp(buffer, "HDMV", 4)) {
+			return false;
+		}
+
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || !check_version()) {
+			return false;
+		}
+
+		// Sequence info start address
+		reader.skip(4, ec);
+		const auto program_info_start_address = reader.read_uint32(ec);
+		const auto cpi_start_address = reader.read_uint32(ec);
+		if (ec || !read_program_info(reader, program_info_start_address, clip_info)) {
+			return false;
+		}
+
+		reader.seek(cpi_start_address, ec);
+		const auto cpi_length = reader.read_uint32(ec);
 		if (ec) {
 			return false;
 		}
 
-		BDParser::stream_t s;
+		// Clips without CPI have no entry points, that is not an error
+		if (!cpi_length) {
+			return true;
+		}
 
-		switch (stream_type) {
-			case 1:
-				s.pid = reader.read_uint16(ec);
-				break;
-			case 2:
-			case 4:
-				reader.skip(2, ec);
-				s.pid = reader.read_uint16(ec);
-				break;
-			case 3:
-				reader.skip(1, ec);
-				s.pid = reader.read_uint16(ec);
-				break;
-			default:
-				return false;
+		reader.skip(1, ec);
+		const auto cpi_type = reader.read_uint8(ec) & 0xF;
+		const auto ep_map_address = reader.position(ec);
+		if (ec || cpi_type != 1) {
+			return !ec;
 		}
 
-		reader.seek(pos + size, ec);
-		size = reader.read_uint8(ec);
-		pos = reader.position(ec);
+		reader.skip(1, ec);
+		const auto number_of_stream_pid_entries = reader.read_uint8(ec);
 		if (ec) {
 			return false;
 		}
 
-		auto it = std::find_if(streams.begin(), streams.end(), [pid = s.pid](const auto& s) {
-			return s.pid == pid;
-		});
-		if (it != streams.end()) {
-			reader.seek(pos + size, ec);
+		// The EP map of the first video stream is used, or of the first stream when there is no video
+		uint32_t number_of_coarse_entries = {};
+		uint32_t number_of_fine_entries = {};
+		uint32_t ep_stream_address = {};
+		bool found_video = false;
+		for (uint8_t i = 0; i < number_of_stream_pid_entries && !found_video; i++) {
+			const auto pid = reader.read_uint16(ec);
+			const auto value = reader.read_uint16(ec);
+			const auto counts = reader.read_uint32(ec);
+			const auto address = reader.read_uint32(ec);
+			if (ec) {
+				return false;
+			}
+
+			found_video = ((value >> 2) & 0xF) == 1;
+			if (found_video || i == 0) {
+				clip_info.ep_pid = pid;
+				number_of_coarse_entries = ((value & 0x3) << 14) | (counts >> 18);
+				number_of_fine_entries = counts & 0x3FFFF;
+				ep_stream_address = address;
+			}
+		}
+
+		if (!number_of_coarse_entries || !number_of_fine_entries) {
 			return true;
 		}
 
-		s.type = static_cast<decltype(s.type)>(reader.read_uint8(ec));
+		reader.seek(ep_map_address + ep_stream_address, ec);
+		const auto fine_table_address = reader.read_uint32(ec);
 		if (ec) {
 			return false;
 		}
 
-		switch (s.type) {
-			case StreamType::MPEG1_VIDEO:
-			case StreamType::MPEG2_VIDEO:
-			case StreamType::H264_VIDEO:
-			case StreamType::H264_MVC_VIDEO:
-			case StreamType::HEVC_VIDEO:
-			case StreamType::VC1_VIDEO:
-				{
-					auto value = reader.read_uint8(ec);
-					s.video_format = static_cast<decltype(s.video_format)>(value >> 4);
-					s.frame_rate = static_cast<decltype(s.frame_rate)>(value & 0xf);
-				}
-				break;
-			case StreamType::MPEG1_AUDIO:
-			case StreamType::MPEG2_AUDIO:
-			case StreamType::LPCM_AUDIO:
-			case StreamType::AC3_AUDIO:
-			case StreamType::DTS_AUDIO:
-			case StreamType::AC3_TRUE_HD_AUDIO:
-			case StreamType::AC3_PLUS_AUDIO:
-			case StreamType::DTS_HD_AUDIO:
-			case StreamType::DTS_HD_MASTER_AUDIO:
-			case StreamType::AC3_PLUS_SECONDARY_AUDIO:
-			case StreamType::DTS_HD_SECONDARY_AUDIO:
-				{
-					auto value = reader.read_uint8(ec);
-					s.channel_layout = static_cast<decltype(s.channel_layout)>(value >> 4);
-					s.sample_rate = static_cast<decltype(s.sample_rate)>(value & 0xf);
-					read_lang_code(reader, s, ec);
-				}
-				break;
-			case StreamType::PRESENTATION_GRAPHICS:
-			case StreamType::INTERACTIVE_GRAPHICS:
-				read_lang_code(reader, s, ec);
-				break;
-			case StreamType::SUBTITLE:
-				reader.skip(1, ec);
-				read_lang_code(reader, s, ec);
-				break;
-			default:
-				break;
+		struct coarse_entry_t {
+			uint32_t ref_fine_id;
+			uint32_t pts;
+			uint32_t spn;
+		};
+
+		std::vector<coarse_entry_t> coarse_entries(number_of_coarse_entries);
+		for (auto& entry : coarse_entries) {
+			const auto value = reader.read_uint32(ec);
+			entry.ref_fine_id = value >> 14;
+			// Bits 32..19 of the 90 kHz PTS, the lowest one is repeated in the fine entry
+			entry.pts = value & 0x3FFE;
+			entry.spn = reader.read_uint32(ec) & ~0x1FFFFu;
 		}
 
+		reader.seek(ep_map_address + ep_stream_address + fine_table_address, ec);
 		if (ec) {
 			return false;
 		}
 
-		streams.emplace_back(s);
+		clip_info.ep_anchors.reserve((number_of_fine_entries + BDParser::clip_info_t::ep_block_size - 1) / BDParser::clip_info_t::ep_block_size);
+		clip_info.ep_deltas.reserve(number_of_fine_entries * 4);
+
+		std::size_t coarse_index = {};
+		uint32_t last_pts = {};
+		uint32_t last_spn = {};
+		for (uint32_t i = 0; i < number_of_fine_entries; i++) {
+			const auto value = reader.read_uint32(ec);
+			if (ec) {
+				return false;
+			}
+
+			while (coarse_index + 1 < coarse_entries.size() && coarse_entries[coarse_index + 1].ref_fine_id <= i) {
+				coarse_index++;
+			}
+			const auto& coarse = coarse_entries[coarse_index];
+
+			// 90 kHz PTS is (coarse << 19) + (fine << 9), stored at 45 kHz so it fits 32 bits
+			const auto pts = static_cast<uint32_t>(((static_cast<uint64_t>(coarse.pts) << 19) + (static_cast<uint64_t>((value >> 17) & 0x7FF) << 9)) >> 1);
+			const auto spn = coarse.spn + (value & 0x1FFFF);
+
+			// Out of order entries would break the binary search
+			if (clip_info.ep_count && (pts < last_pts || spn < last_spn)) {
+				continue;
+			}
+
+			add_entry_point(clip_info, pts, spn, last_pts, last_spn);
+		}
 
-		reader.seek(pos + size, ec);
+		clip_info.ep_deltas.shrink_to_fit();
 
 		return true;
 	}
 
-	[[nodiscard]] static bool read_stn_info(IReader& reader, std::vector<BDParser::stream_t>& streams)
+	template<typename Reader>
+	[[nodiscard]] static bool read_clip_info_file(const std::string& path, BDParser::clip_info_t& clip_info)
 	{
 		std::error_code ec = {};
-		reader.skip(4, ec);
-
-		auto num_video = reader.read_uint8(ec);
-		auto num_audio = reader.read_uint8(ec);
-		auto num_pg = reader.read_uint8(ec);
-		auto num_ig = reader.read_uint8(ec);
-		auto num_secondary_audio = reader.read_uint8(ec);
-		auto num_secondary_video = reader.read_uint8(ec);
-		auto num_pip_pg = reader.read_uint8(ec);
-
+		Reader reader(path, ec);
 		if (ec) {
 			return false;
 		}
 
-		reader.skip(5, ec);
+		return read_clip_info(reader, clip_info);
+	}
 
-		if (streams.empty()) {
-			streams.reserve(static_cast<size_t>(num_video) + num_audio + num_pg + num_ig +
-							num_secondary_audio + num_secondary_video + num_pip_pg);
+	// FNV-1a
+	[[nodiscard]] static uint64_t hash_bytes(const uint8_t* data, std::size_t size) noexcept
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (std::size_t i = 0; i < size; i++) {
+			hash = (hash ^ data[i]) * 0x100000001B3ull;
 		}
 
-		for (uint8_t i = 0; i < num_video; i++) {
-			if (!(read_stream_info(reader, streams))) {
-				return false;
-			}
+		return hash;
+	}
+
+	[[nodiscard]] static uint64_t hash_combine(uint64_t seed, uint64_t value) noexcept
+	{
+		return seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+	}
+
+	// Covers exactly the fields compared by playlist_t::operator==
+	[[nodiscard]] static uint64_t playlist_hash(const BDParser::playlist_t& playlist) noexcept
+	{
+		uint64_t hash = hash_combine(0, playlist.duration);
+
+		for (const auto& item : playlist.items) {
+			hash = hash_combine(hash, item.clip_id);
+			hash = hash_combine(hash, item.start_pts);
+			hash = hash_combine(hash, item.end_pts);
+			hash = hash_combine(hash, item.start_time);
+			hash = hash_combine(hash, item.angle_count);
 		}
 
-		for (uint8_t i = 0; i < num_audio; i++) {
-			if (!(read_stream_info(reader, streams))) {
-				return false;
-			}
+		for (const auto angle_clip_id : playlist.angle_clip_ids) {
+			hash = hash_combine(hash, angle_clip_id);
 		}
 
-		for (uint8_t i = 0; i < (num_pg + num_pip_pg); i++) {
-			if (!(read_stream_info(reader, streams))) {
-				return false;
-			}
+		for (const auto& stream : playlist.streams) {
+			hash = hash_combine(hash, stream.pid);
+			hash = hash_combine(hash, static_cast<uint64_t>(stream.type));
+			hash = hash_combine(hash, std::hash<std::string_view>{}(std::string_view(stream.lang_code.data(), stream.lang_code.size())));
+			hash = hash_combine(hash, (static_cast<uint64_t>(stream.video_format) << 48) | (static_cast<uint64_t>(stream.frame_rate) << 32) |
+									  static_cast<uint64_t>(stream.aspect_ratio));
+			hash = hash_combine(hash, (static_cast<uint64_t>(stream.channel_layout) << 32) | static_cast<uint64_t>(stream.sample_rate));
 		}
 
-		for (uint8_t i = 0; i < num_ig; i++) {
-			if (!(read_stream_info(reader, streams))) {
-				return false;
-			}
+		for (const auto& mark : playlist.marks) {
+			hash = hash_combine(hash, mark.time);
+			hash = hash_combine(hash, (static_cast<uint64_t>(mark.item_index) << 8) | static_cast<uint64_t>(mark.type));
 		}
 
-		for (uint8_t i = 0; i < num_secondary_audio; i++) {
-			if (!(read_stream_info(reader, streams))) {
+		return hash;
+	}
+
+	template<typename Reader, typename DataFilter>
+	[[nodiscard]] static bool read_playlist_file(const std::string& playlist_path, const std::shared_ptr<const std::string>& root_path, const BDParser::options_t& options,
+											DataFilter&& filter, BDParser::playlist_t& playlist)
+	{
+		std::error_code ec = {};
+		Reader reader(playlist_path, ec);
+		if (ec) {
+			return false;
+		}
+
+		// Memory backed readers let the caller look at the raw file before it is decoded
+		if constexpr (std::is_base_of_v<MemoryReader, Reader>) {
+			if (!filter(reader.data(), reader.size())) {
 				return false;
 			}
+		}
 
-			// Secondary Audio Extra Attributes
-			const auto num_secondary_audio_extra = reader.read_uint8(ec);
-			reader.skip(1, ec);
-			if (num_secondary_audio_extra) {
-				reader.skip(num_secondary_audio_extra, ec);
-				if (num_secondary_audio_extra % 2) {
-					reader.skip(1, ec);
-				}
-			}
+		return read_playlist(reader, root_path, options, playlist);
+	}
 
-			if (ec) {
-				return false;
+	template<typename DataFilter>
+	[[nodiscard]] static bool read_playlist(const std::string& playlist_path, const std::shared_ptr<const std::string>& root_path, const BDParser::options_t& options,
+											DataFilter&& filter, BDParser::playlist_t& playlist)
+	{
+		bool ret = false;
+		switch (options.reader_type) {
+			case ReaderType::Stream:
+				ret = read_playlist_file<StreamReader>(playlist_path, root_path, options, filter, playlist);
+				break;
+			case ReaderType::Mmap:
+				ret = read_playlist_file<MmapReader>(playlist_path, root_path, options, filter, playlist);
+				break;
+			case ReaderType::Buffer:
+			default:
+				ret = read_playlist_file<BufferReader>(playlist_path, root_path, options, filter, playlist);
+				break;
+		}
+
+		if (ret) {
+			playlist.mpls_file_name = playlist_path;
+			playlist.hash = playlist_hash(playlist);
+		}
+
+		return ret;
+	}
+
+	template<typename Func>
+	static void parallel_for(std::size_t count, unsigned threads, Func&& func)
+	{
+		if (!threads) {
+			threads = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		threads = static_cast<unsigned>(std::min<std::size_t>(threads, count));
+
+		if (threads <= 1) {
+			for (std::size_t i = 0; i < count; i++) {
+				func(i);
 			}
+			return;
+		}
+
+		// Every worker owns a contiguous range of indices and takes work from its front.
+		// A worker whose range is empty steals the upper half of another worker's range.
+		struct alignas(64) range_t {
+			std::mutex mutex;
+			std::size_t begin = {};
+			std::size_t end = {};
+		};
+
+		std::vector<range_t> ranges(threads);
+		for (unsigned i = 0; i < threads; i++) {
+			ranges[i].begin = count * i / threads;
+			ranges[i].end = count * (i + 1) / threads;
 		}
 
-		for (uint8_t i = 0; i < num_secondary_video; i++) {
-			if (!(read_stream_info(reader, streams))) {
+		auto pop = [&](unsigned id, std::size_t& index) {
+			std::lock_guard lock(ranges[id].mutex);
+			if (ranges[id].begin == ranges[id].end) {
 				return false;
 			}
 
-			// Secondary Video Extra Attributes
-			const auto num_secondary_video_extra = reader.read_uint8(ec);
-			reader.skip(1, ec);
-			if (num_secondary_video_extra) {
-				reader.skip(num_secondary_video_extra, ec);
-				if (num_secondary_video_extra % 2) {
-					reader.skip(1, ec);
+			index = ranges[id].begin++;
+			return true;
+		};
+
+		auto steal = [&](unsigned id, std::size_t& index) {
+			for (unsigned i = 1; i < threads; i++) {
+				auto& victim = ranges[(id + i) % threads];
+
+				std::size_t begin = {};
+				std::size_t end = {};
+				{
+					std::lock_guard lock(victim.mutex);
+					if (victim.begin == victim.end) {
+						continue;
+					}
+
+					end = victim.end;
+					begin = victim.begin + (victim.end - victim.begin) / 2;
+					victim.end = begin;
 				}
-			}
 
-			const auto num_pip_pg_extra = reader.read_uint8(ec);
-			reader.skip(1, ec);
-			if (num_pip_pg_extra) {
-				reader.skip(num_pip_pg_extra, ec);
-				if (num_pip_pg_extra % 2) {
-					reader.skip(1, ec);
+				index = begin++;
+				if (begin != end) {
+					std::lock_guard lock(ranges[id].mutex);
+					ranges[id].begin = begin;
+					ranges[id].end = end;
 				}
+				return true;
 			}
 
-			if (ec) {
-				return false;
+			return false;
+		};
+
+		auto worker = [&](unsigned id) {
+			std::size_t index = {};
+			while (pop(id, index) || steal(id, index)) {
+				func(index);
 			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+		for (unsigned i = 1; i < threads; i++) {
+			pool.emplace_back(worker, i);
 		}
+		worker(0);
 
-		return true;
+		for (auto& thread : pool) {
+			thread.join();
+		}
 	}
 
-	#define check_version() (!(std::memcmp(buffer, "0300", 4)) || (!std::memcmp(buffer, "0200", 4)) || (!std::memcmp(buffer, "0100", 4)))
+	// Titles of index.bdmv and the playlists their HDMV movie objects play. Only PlayPL commands with an
+	// immediate playlist number can be resolved without running the objects, playlists picked through
+	// registers are missed.
+
+	struct index_title_t {
+		bool hdmv;
+		uint16_t object_id;
+	};
 
-	bool BDParser::parse_playlist(const std::string& playlist_path, std::string_view root_path, bool skip_playlist_duplicate, bool check_m2ts_files) noexcept
+	[[nodiscard]] static bool read_index(const std::string& path, std::vector<index_title_t>& titles)
 	{
 		std::error_code ec = {};
+		BufferReader reader(path, ec);
 
-		StreamReader reader(playlist_path, ec);
-		if (ec) {
-			return false;
-		}
-
-		char buffer[9] = {};
+		char buffer[4] = {};
 		reader.read_buffer(buffer, 4, ec);
-		if (ec || std::memcmp(buffer, "MPLS", 4)) {
+		if (ec || std::memcmp(buffer, "INDX", 4)) {
 			return false;
 		}
 
@@ -346,132 +513,1286 @@ namespace parser {
 			return false;
 		}
 
-		auto playlist_start_address = reader.read_uint32(ec);
+		const auto indexes_start_address = reader.read_uint32(ec);
+		reader.seek(indexes_start_address, ec);
+		// Length, first playback and top menu objects
+		reader.skip(4 + 12 + 12, ec);
+		const auto number_of_titles = reader.read_uint16(ec);
 		if (ec) {
 			return false;
 		}
 
-		reader.seek(playlist_start_address, ec);
-		reader.skip(6, ec);
-		auto number_of_playlist_items = reader.read_uint16(ec);
-		if (ec) {
-			return false;
-		}
-
-		playlist_t playlist;
-		playlist.mpls_file_name = playlist_path;
-
-		playlist_start_address += 10;
-		for (uint16_t i = 0; i < number_of_playlist_items; i++) {
-			reader.seek(playlist_start_address, ec);
-			playlist_start_address += reader.read_uint16(ec) + 2;
-			reader.read_buffer(buffer, 9, ec);
-			if (ec || std::memcmp(&buffer[5], "M2TS", 4)) {
+		titles.reserve(number_of_titles);
+		for (uint16_t i = 0; i < number_of_titles; i++) {
+			// object_type:2 access_type:2, then playback_type:2 and the id_ref of an HDMV object
+			const auto object_type = reader.read_uint8(ec) >> 6;
+			reader.skip(5, ec);
+			const auto object_id = reader.read_uint16(ec);
+			reader.skip(4, ec);
+			if (ec) {
 				return false;
 			}
 
-			playlist_item_t item;
-			item.file_name = std::format("{}/STREAM/{}{}{}{}{}.M2TS", root_path,
-										 buffer[0], buffer[1], buffer[2], buffer[3], buffer[4]);
-			if (check_m2ts_files && !std::filesystem::exists(item.file_name, ec)) {
-				return false;
-			}
-			if (std::find_if(playlist.items.begin(), playlist.items.end(), [&](const auto& _item) {
-						return item.file_name == _item.file_name;
-					}) != playlist.items.end()) {
-				// Ignore playlists with duplicate files
-				return false;
-			}
+			titles.push_back({ object_type == 1, object_id });
+		}
 
-			reader.read_buffer(buffer, 3, ec);
-			if (ec) {
-				return false;
-			}
-			bool multi_angle = (buffer[1] >> 4) & 0x1;
-			item.start_pts = static_cast<pts_t>(20000.0 * reader.read_uint32(ec) / 90);
-			item.end_pts = static_cast<pts_t>(20000.0 * reader.read_uint32(ec) / 90);
-			if (ec) {
-				return false;
-			}
+		return true;
+	}
 
-			item.start_time = playlist.duration;
-			playlist.duration += (item.end_pts - item.start_pts);
+	struct movie_object_t {
+		// Immediate operands of the PlayPL, PlayPLatPI and PlayPLatMK commands
+		std::vector<uint32_t> playlist_ids;
+		// Immediate operands of the JumpObject and CallObject commands
+		std::vector<uint16_t> object_ids;
+	};
 
-			reader.skip(12, ec);
-			uint8_t angle_count = 1;
-			if (multi_angle) {
-				angle_count = reader.read_uint8(ec);
-				if (angle_count < 1) {
-					angle_count = 1;
-				}
-				reader.skip(1, ec);
-			}
-			for (uint8_t j = 1; j < angle_count; j++) {
-				reader.skip(10, ec);
-			}
-			if (ec) {
-				return false;
-			}
+	[[nodiscard]] static bool read_movie_objects(const std::string& path, std::vector<movie_object_t>& objects)
+	{
+		std::error_code ec = {};
+		BufferReader reader(path, ec);
 
-			if (!read_stn_info(reader, playlist.streams)) {
-				return false;
-			}
+		char buffer[4] = {};
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || std::memcmp(buffer, "MOBJ", 4)) {
+			return false;
+		}
 
-			playlist.items.emplace_back(std::move(item));
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || !check_version()) {
+			return false;
 		}
 
-		if (!playlist.duration) {
+		// Movie objects start after the header, with their length and a reserved field
+		reader.seek(40 + 8, ec);
+		const auto number_of_objects = reader.read_uint16(ec);
+		if (ec) {
 			return false;
 		}
 
-		if (skip_playlist_duplicate) {
-			for (const auto& item : playlists_) {
-				if (playlist == item) {
-					return false;
+		objects.resize(number_of_objects);
+		for (auto& object : objects) {
+			reader.skip(2, ec);
+			const auto number_of_commands = reader.read_uint16(ec);
+			for (uint16_t i = 0; i < number_of_commands && !ec; i++) {
+				// op_cnt:3 grp:2 sub_grp:3 imm_op1:1 imm_op2:1 reserved:2 branch_opt:4 ..., destination, source
+				const auto opcode = reader.read_uint32(ec);
+				const auto destination = reader.read_uint32(ec);
+				reader.skip(4, ec);
+
+				const auto group = (opcode >> 27) & 0x3;
+				const auto sub_group = (opcode >> 24) & 0x7;
+				const bool immediate = (opcode >> 23) & 0x1;
+				const auto branch_option = (opcode >> 16) & 0xF;
+				if (group != 0 || !immediate) {
+					continue;
+				}
+
+				if (sub_group == 2 && branch_option <= 2) {
+					object.playlist_ids.push_back(destination);
+				} else if (sub_group == 1 && (branch_option == 0 || branch_option == 2)) {
+					object.object_ids.push_back(static_cast<uint16_t>(destination));
 				}
 			}
-		}
 
-		playlists_.emplace_back(std::move(playlist));
+			if (ec) {
+				return false;
+			}
+		}
 
 		return true;
 	}
 
-	bool BDParser::parse(std::string_view path, bool skip_playlist_duplicate, bool check_m2ts_files)
+	[[nodiscard]] static bool read_titles(const std::string& path, std::vector<BDParser::title_t>& titles)
 	{
-		constexpr std::string_view check_paths[] = {
-			"index.bdmv",
-			"CLIPINF",
-			"PLAYLIST",
-			"STREAM"
-		};
+		std::vector<index_title_t> index_titles;
+		std::vector<movie_object_t> objects;
+		if (!read_index((std::filesystem::path(path) / "index.bdmv").string(), index_titles) ||
+				!read_movie_objects((std::filesystem::path(path) / "MovieObject.bdmv").string(), objects)) {
+			return false;
+		}
 
-		// Checking required paths
-		std::error_code ec = {};
-		for (auto& check_path : check_paths) {
-			if (!std::filesystem::exists(path / std::filesystem::path(check_path), ec)) {
-				return false;
+		titles.resize(index_titles.size());
+		for (std::size_t i = 0; i < index_titles.size(); i++) {
+			auto& title = titles[i];
+			title.number = static_cast<uint16_t>(i + 1);
+			title.hdmv = index_titles[i].hdmv;
+			if (!title.hdmv) {
+				continue;
 			}
-		}
 
-		playlists_.clear();
+			// Follow the objects the title jumps to or calls, each one once
+			std::vector<bool> visited(objects.size());
+			std::vector<uint16_t> pending = { index_titles[i].object_id };
+			while (!pending.empty()) {
+				const auto object_id = pending.back();
+				pending.pop_back();
+				if (object_id >= objects.size() || visited[object_id]) {
+					continue;
+				}
+				visited[object_id] = true;
 
-		// Read playlists
-		std::filesystem::path playlist_path = path / std::filesystem::path("PLAYLIST");
-		for (const auto& entry : std::filesystem::directory_iterator(playlist_path)) {
-			if (entry.is_regular_file() && string::ends_with(entry.path().string(), ".mpls")) {
-				parse_playlist(entry.path().string(), path, skip_playlist_duplicate, check_m2ts_files);
+				const auto& object = objects[object_id];
+				for (const auto playlist_id : object.playlist_ids) {
+					if (std::find(title.playlist_ids.begin(), title.playlist_ids.end(), playlist_id) == title.playlist_ids.end()) {
+						title.playlist_ids.push_back(playlist_id);
+					}
+				}
+				pending.insert(pending.end(), object.object_ids.rbegin(), object.object_ids.rend());
 			}
 		}
 
-		if (playlists_.empty()) {
+		return true;
+	}
+
+	struct playlist_slot_t {
+		uint32_t playlist_id = {};
+		std::string path;
+		BDParser::playlist_t playlist;
+		bool valid = false;
+
+		// Hash of the raw file, set when duplicates are skipped and the reader keeps the file in memory
+		bool hashed = false;
+		uint64_t raw_hash = {};
+		// The raw hash went through claim_raw_playlist, only such slots can be raw duplicates
+		bool claimed = false;
+		// Byte-identical copy of an earlier playlist file, not decoded
+		bool raw_duplicate = false;
+	};
+
+	struct disc_state_t {
+		std::shared_ptr<const std::string> root_path;
+		std::vector<playlist_slot_t> slots;
+
+		// Key of the parse cache entry, zero when the cache isn't used
+		uint64_t cache_key = {};
+		// Playlists were loaded from the parse cache or from the content cache
+		bool cached = false;
+		bool metadata_cached = false;
+
+		// Content fingerprint of index.bdmv and the playlist files
+		uint64_t fingerprint = {};
+		bool fingerprinted = false;
+
+		// Titles read with options_t::titles_only, the playlists they play and a hash of that mapping
+		std::vector<BDParser::title_t> titles;
+		std::unordered_set<uint32_t> title_playlists;
+		uint64_t titles_hash = {};
+
+		// Raw file hash -> lowest slot index with that content, only that copy needs decoding
+		std::mutex mutex;
+		std::unordered_map<uint64_t, std::size_t> raw_owners;
+	};
+
+	[[nodiscard]] static uint64_t hash_file_data(const uint8_t* data, std::size_t size) noexcept
+	{
+		return hash_combine(hash_bytes(data, size), size);
+	}
+
+	[[nodiscard]] static bool hash_file(const std::string& path, uint64_t& hash)
+	{
+		std::error_code ec = {};
+		BufferReader reader(path, ec);
+		if (ec) {
 			return false;
 		}
 
-		std::sort(playlists_.begin(), playlists_.end(), [&](const auto& a, const auto& b) {
-			return a.duration > b.duration;
-		});
+		hash = hash_file_data(reader.data(), reader.size());
 
 		return true;
 	}
-}
+
+	[[nodiscard]] static uint64_t hash_string(std::string_view str) noexcept
+	{
+		return hash_bytes(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+	}
+
+	// The fingerprint covers the contents of index.bdmv and the names and contents of the playlist files,
+	// so every copy of a disc gets the same value wherever it is stored.
+	[[nodiscard]] static bool make_fingerprint(const std::string& path, disc_state_t& state)
+	{
+		uint64_t hash = {};
+		if (!hash_file((std::filesystem::path(path) / "index.bdmv").string(), hash)) {
+			return false;
+		}
+
+		uint64_t fingerprint = hash_combine(hash_string("BDMV"), hash);
+		for (auto& slot : state.slots) {
+			if (!slot.hashed) {
+				if (!hash_file(slot.path, slot.raw_hash)) {
+					return false;
+				}
+				slot.hashed = true;
+			}
+
+			fingerprint = hash_combine(fingerprint, hash_string(std::filesystem::path(slot.path).filename().string()));
+			fingerprint = hash_combine(fingerprint, slot.raw_hash);
+		}
+
+		state.fingerprint = fingerprint;
+		state.fingerprinted = true;
+
+		return true;
+	}
+
+	// Returns false when an earlier byte-identical copy of the playlist has been or will be decoded instead
+	[[nodiscard]] static bool claim_raw_playlist(disc_state_t& state, std::size_t index)
+	{
+		const auto raw_hash = state.slots[index].raw_hash;
+
+		std::lock_guard lock(state.mutex);
+		auto [it, inserted] = state.raw_owners.try_emplace(raw_hash, index);
+		if (!inserted) {
+			if (it->second < index) {
+				return false;
+			}
+			it->second = index;
+		}
+
+		return true;
+	}
+
+	static void resolve_raw_duplicates(disc_state_t& state, bool skip_playlist_duplicate)
+	{
+		for (std::size_t i = 0; i < state.slots.size(); i++) {
+			auto& slot = state.slots[i];
+			if (!skip_playlist_duplicate || !slot.claimed) {
+				slot.raw_duplicate = false;
+				continue;
+			}
+
+			const auto it = state.raw_owners.find(slot.raw_hash);
+			slot.raw_duplicate = it != state.raw_owners.end() && it->second != i;
+		}
+	}
+
+	// Parse cache, one file per entry holding the decoded playlists of a disc in path order.
+	// Metadata entries are named after the root path and stay valid while the root, the options that
+	// change decoding and the size/mtime/inode of index.bdmv and of every playlist file are unchanged.
+	// Content entries are named after the disc fingerprint and are shared by all copies of a disc.
+
+	constexpr char cache_magic[4] = { 'B', 'D', 'P', 'C' };
+	constexpr uint32_t cache_version = 8;
+
+	struct file_stat_t {
+		uint64_t size = {};
+		uint64_t mtime = {};
+		uint64_t inode = {};
+	};
+
+	[[nodiscard]] static bool get_file_stat(const std::string& path, file_stat_t& file_stat) noexcept
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA data = {};
+		if (!GetFileAttributesExW(std::filesystem::path(path).c_str(), GetFileExInfoStandard, &data)) {
+			return false;
+		}
+
+		file_stat.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		file_stat.mtime = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+		file_stat.inode = {};
+#else
+		struct stat st = {};
+		if (::stat(path.c_str(), &st)) {
+			return false;
+		}
+
+		file_stat.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+		file_stat.mtime = static_cast<uint64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		file_stat.mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		file_stat.inode = static_cast<uint64_t>(st.st_ino);
+#endif
+
+		return true;
+	}
+
+	[[nodiscard]] static bool make_cache_key(const std::string& path, const disc_state_t& state, const BDParser::options_t& options, uint64_t& key)
+	{
+		key = hash_combine(hash_string(path), cache_version);
+		key = hash_combine(key, options.skip_playlist_duplicate);
+		key = hash_combine(key, options.summary_only);
+		key = hash_combine(key, options.min_duration);
+		// titles_hash is zero both without titles_only and when index.bdmv lists no titles
+		key = hash_combine(hash_combine(key, options.titles_only), state.titles_hash);
+		// Entries written without a fingerprint hold zero
+		key = hash_combine(key, options.fingerprint || !options.content_cache_path.empty());
+
+		file_stat_t file_stat;
+		if (!get_file_stat((std::filesystem::path(path) / "index.bdmv").string(), file_stat)) {
+			return false;
+		}
+		key = hash_combine(hash_combine(hash_combine(key, file_stat.size), file_stat.mtime), file_stat.inode);
+
+		for (const auto& slot : state.slots) {
+			if (!get_file_stat(slot.path, file_stat)) {
+				return false;
+			}
+			key = hash_combine(key, hash_string(slot.path));
+			key = hash_combine(hash_combine(hash_combine(key, file_stat.size), file_stat.mtime), file_stat.inode);
+		}
+
+		return true;
+	}
+
+	[[nodiscard]] static std::string cache_file_name(const std::string& cache_path, const std::string& path)
+	{
+		return (std::filesystem::path(cache_path) / std::format("{:016x}.bdcache", hash_string(path))).string();
+	}
+
+	[[nodiscard]] static uint64_t make_content_cache_key(const disc_state_t& state, const BDParser::options_t& options) noexcept
+	{
+		auto key = hash_combine(hash_combine(state.fingerprint, cache_version), options.skip_playlist_duplicate);
+		key = hash_combine(hash_combine(key, options.summary_only), options.min_duration);
+		return hash_combine(hash_combine(key, options.titles_only), state.titles_hash);
+	}
+
+	[[nodiscard]] static std::string content_cache_file_name(const std::string& cache_path, uint64_t fingerprint)
+	{
+		return (std::filesystem::path(cache_path) / std::format("{:016x}.bdcache", fingerprint)).string();
+	}
+
+	static void write_cached_playlist(BufferWriter& writer, const BDParser::playlist_t& playlist)
+	{
+		writer.write_uint64(playlist.duration);
+
+		writer.write_uint32(static_cast<uint32_t>(playlist.items.size()));
+		for (const auto& item : playlist.items) {
+			writer.write_uint32(item.clip_id);
+			writer.write_uint64(item.start_pts);
+			writer.write_uint64(item.end_pts);
+			writer.write_uint64(item.start_time);
+			writer.write_uint16(item.first_angle);
+			writer.write_uint8(item.angle_count);
+		}
+
+		writer.write_uint32(static_cast<uint32_t>(playlist.angle_clip_ids.size()));
+		for (const auto angle_clip_id : playlist.angle_clip_ids) {
+			writer.write_uint32(angle_clip_id);
+		}
+
+		writer.write_uint32(static_cast<uint32_t>(playlist.streams.size()));
+		for (const auto& stream : playlist.streams) {
+			writer.write_uint16(stream.pid);
+			writer.write_uint8(static_cast<uint8_t>(stream.type));
+			writer.write_buffer(stream.lang_code.data(), stream.lang_code.size());
+			writer.write_uint8(static_cast<uint8_t>(stream.video_format));
+			writer.write_uint8(static_cast<uint8_t>(stream.frame_rate));
+			writer.write_uint8(static_cast<uint8_t>(stream.aspect_ratio));
+			writer.write_uint8(static_cast<uint8_t>(stream.channel_layout));
+			writer.write_uint8(static_cast<uint8_t>(stream.sample_rate));
+		}
+
+		writer.write_uint32(static_cast<uint32_t>(playlist.marks.size()));
+		for (const auto& mark : playlist.marks) {
+			writer.write_uint64(mark.time);
+			writer.write_uint16(mark.item_index);
+			writer.write_uint8(static_cast<uint8_t>(mark.type));
+		}
+	}
+
+	template<typename Reader>
+	[[nodiscard]] static bool read_cached_playlist(Reader& reader, const std::shared_ptr<const std::string>& root_path, BDParser::playlist_t& playlist)
+	{
+		std::error_code ec = {};
+		playlist.duration = read_uint64(reader, ec);
+
+		const auto number_of_items = reader.read_uint32(ec);
+		for (uint32_t i = 0; i < number_of_items && !ec; i++) {
+			auto& item = playlist.items.emplace_back();
+			item.root_path = root_path;
+			item.clip_id = reader.read_uint32(ec);
+			item.start_pts = read_uint64(reader, ec);
+			item.end_pts = read_uint64(reader, ec);
+			item.start_time = read_uint64(reader, ec);
+			item.first_angle = reader.read_uint16(ec);
+			item.angle_count = reader.read_uint8(ec);
+			playlist.item_start_times.push_back(item.start_time);
+		}
+
+		const auto number_of_angle_clips = reader.read_uint32(ec);
+		for (uint32_t i = 0; i < number_of_angle_clips && !ec; i++) {
+			playlist.angle_clip_ids.push_back(reader.read_uint32(ec));
+		}
+
+		const auto number_of_streams = reader.read_uint32(ec);
+		for (uint32_t i = 0; i < number_of_streams && !ec; i++) {
+			auto& stream = playlist.streams.emplace_back();
+			stream.pid = reader.read_uint16(ec);
+			stream.type = static_cast<decltype(stream.type)>(reader.read_uint8(ec));
+			reader.read_buffer(stream.lang_code.data(), stream.lang_code.size(), ec);
+			stream.video_format = static_cast<decltype(stream.video_format)>(reader.read_uint8(ec));
+			stream.frame_rate = static_cast<decltype(stream.frame_rate)>(reader.read_uint8(ec));
+			stream.aspect_ratio = static_cast<decltype(stream.aspect_ratio)>(reader.read_uint8(ec));
+			stream.channel_layout = static_cast<decltype(stream.channel_layout)>(reader.read_uint8(ec));
+			stream.sample_rate = static_cast<decltype(stream.sample_rate)>(reader.read_uint8(ec));
+		}
+
+		const auto number_of_marks = reader.read_uint32(ec);
+		for (uint32_t i = 0; i < number_of_marks && !ec; i++) {
+			auto& mark = playlist.marks.emplace_back();
+			mark.time = read_uint64(reader, ec);
+			mark.item_index = reader.read_uint16(ec);
+			mark.type = static_cast<decltype(mark.type)>(reader.read_uint8(ec));
+		}
+
+		if (ec) {
+			return false;
+		}
+
+		// The content cache is shared between processes, so the ranges are checked like flat::ResultView does
+		for (const auto& item : playlist.items) {
+			if (static_cast<std::size_t>(item.first_angle) + item.angle_count > playlist.angle_clip_ids.size()) {
+				return false;
+			}
+		}
+		for (const auto& mark : playlist.marks) {
+			if (mark.item_index >= playlist.items.size()) {
+				return false;
+			}
+		}
+
+		playlist.hash = playlist_hash(playlist);
+
+		return true;
+	}
+
+	[[nodiscard]] static bool load_cache(const std::string& file_name, uint64_t cache_key, disc_state_t& state)
+	{
+		std::error_code ec = {};
+		BufferReader reader(file_name, ec);
+		if (ec) {
+			return false;
+		}
+
+		char magic[4] = {};
+		reader.read_buffer(magic, sizeof(magic), ec);
+		const auto version = reader.read_uint32(ec);
+		const auto key = read_uint64(reader, ec);
+		const auto fingerprint = read_uint64(reader, ec);
+		const auto number_of_slots = reader.read_uint32(ec);
+		if (ec || std::memcmp(magic, cache_magic, sizeof(magic)) || version != cache_version ||
+				key != cache_key || number_of_slots != state.slots.size()) {
+			return false;
+		}
+
+		// Decoded aside and committed to the slots only once the whole entry has been read, so a truncated
+		// or corrupt entry leaves them untouched for the decode pass
+		std::vector<uint8_t> slot_flags(state.slots.size());
+		std::vector<BDParser::playlist_t> playlists(state.slots.size());
+		for (std::size_t i = 0; i < state.slots.size(); i++) {
+			slot_flags[i] = reader.read_uint8(ec);
+			if (ec) {
+				return false;
+			}
+
+			if (slot_flags[i] & 0x1) {
+				auto& playlist = playlists[i];
+				playlist.mpls_file_name = state.slots[i].path;
+				playlist.playlist_id = state.slots[i].playlist_id;
+				playlist.summary = slot_flags[i] & 0x4;
+				if (!read_cached_playlist(reader, state.root_path, playlist)) {
+					return false;
+				}
+			}
+		}
+
+		for (std::size_t i = 0; i < state.slots.size(); i++) {
+			auto& slot = state.slots[i];
+			slot.valid = slot_flags[i] & 0x1;
+			slot.raw_duplicate = slot_flags[i] & 0x2;
+			slot.playlist = std::move(playlists[i]);
+		}
+
+		state.fingerprint = fingerprint;
+		state.fingerprinted = true;
+
+		return true;
+	}
+
+	[[nodiscard]] static uint64_t current_process_id() noexcept
+	{
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return static_cast<uint64_t>(::getpid());
+#endif
+	}
+
+	static void store_cache(const std::string& cache_path, const std::string& file_name, uint64_t cache_key, const disc_state_t& state)
+	{
+		BufferWriter writer;
+		writer.write_buffer(cache_magic, sizeof(cache_magic));
+		writer.write_uint32(cache_version);
+		writer.write_uint64(cache_key);
+		writer.write_uint64(state.fingerprint);
+		writer.write_uint32(static_cast<uint32_t>(state.slots.size()));
+		for (const auto& slot : state.slots) {
+			writer.write_uint8((slot.valid ? 0x1 : 0) | (slot.raw_duplicate ? 0x2 : 0) | (slot.playlist.summary ? 0x4 : 0));
+			if (slot.valid) {
+				write_cached_playlist(writer, slot.playlist);
+			}
+		}
+
+		// Write to a temporary file first so readers never see a partial entry
+		std::error_code ec = {};
+		std::filesystem::create_directories(cache_path, ec);
+
+		// Unique per process and thread, as several processes may share the cache directory
+		const auto temp_file_name = std::format("{}.{}.{}.tmp", file_name, current_process_id(), std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		{
+			std::ofstream stream(temp_file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!stream.is_open()) {
+				return;
+			}
+
+			const auto& buffer = writer.buffer();
+			stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			// Closing flushes the last of the data, so write errors only show up after it
+			stream.close();
+			if (stream.fail()) {
+				std::filesystem::remove(temp_file_name, ec);
+				return;
+			}
+		}
+
+		std::filesystem::rename(temp_file_name, file_name, ec);
+		if (ec) {
+			std::filesystem::remove(temp_file_name, ec);
+		}
+	}
+
+	// Finds playlists equal to one already added to a result through their hashes
+	class DuplicateFilter final
+	{
+		std::unordered_multimap<uint64_t, std::size_t> hashes_;
+
+	public:
+		explicit DuplicateFilter(std::size_t count) {
+			hashes_.reserve(count);
+		}
+
+		// Returns false when the playlist is a duplicate, otherwise remembers it as the next element of playlists
+		[[nodiscard]] bool add(const std::vector<BDParser::playlist_t>& playlists, const BDParser::playlist_t& playlist) {
+			auto [begin, end] = hashes_.equal_range(playlist.hash);
+			if (std::any_of(begin, end, [&](const auto& item) { return playlists[item.second] == playlist; })) {
+				return false;
+			}
+
+			hashes_.emplace(playlist.hash, playlists.size());
+
+			return true;
+		}
+	};
+
+	// Clip numbers of the STREAM/xxxxx.M2TS files, listed once per disc instead of a stat per item.
+	// playlist_item_t::file_name() always spells the extension .M2TS, so a clip listed under another
+	// case only counts when that name opens too, which depends on the case sensitivity of the filesystem.
+	[[nodiscard]] static std::unordered_set<uint32_t> list_stream_files(const std::string& path)
+	{
+		const auto stream_path = path / std::filesystem::path("STREAM");
+
+		std::unordered_set<uint32_t> clip_ids;
+		std::ignore = list_numbered_files(stream_path, ".m2ts", [&](uint32_t clip_id, std::string_view name) {
+			std::error_code ec = {};
+			if (name.ends_with(".M2TS") || std::filesystem::exists(stream_path / std::format("{:05}.M2TS", clip_id), ec)) {
+				clip_ids.insert(clip_id);
+			}
+		});
+
+		return clip_ids;
+	}
+
+	// Merges the playlists read in path order, so the result doesn't depend on the thread count
+	[[nodiscard]] static bool merge_playlists(disc_state_t& state, const BDParser::options_t& options, BDParser::disc_t& disc)
+	{
+		// Summaries have no streams yet, so only byte-identical copies are skipped for them
+		const bool skip_duplicates = options.skip_playlist_duplicate && !options.summary_only;
+		DuplicateFilter duplicates(skip_duplicates ? state.slots.size() : 0);
+
+		std::unordered_set<uint32_t> stream_files;
+		if (options.check_m2ts_files) {
+			stream_files = list_stream_files(*state.root_path);
+		}
+
+		auto& playlists = disc.playlists;
+		for (auto& slot : state.slots) {
+			if (slot.raw_duplicate) {
+				disc.raw_duplicates++;
+				continue;
+			}
+
+			if (!slot.valid) {
+				continue;
+			}
+
+			auto& playlist = slot.playlist;
+			if (options.check_m2ts_files) {
+				if (!std::all_of(playlist.items.begin(), playlist.items.end(), [&](const auto& item) {
+							return stream_files.contains(item.clip_id);
+						})) {
+					continue;
+				}
+			}
+
+			if (skip_duplicates && !duplicates.add(playlists, playlist)) {
+				continue;
+			}
+
+			playlists.emplace_back(std::move(playlist));
+		}
+
+		if (playlists.empty()) {
+			return false;
+		}
+
+		std::sort(playlists.begin(), playlists.end(), [&](const auto& a, const auto& b) {
+			return a.duration > b.duration;
+		});
+
+		return true;
+	}
+
+	// Decodes every clip used by the playlists of the discs once, on one pool, and shares it between the items
+	static void read_clips(std::span<BDParser::disc_t> discs, const BDParser::options_t& options)
+	{
+		struct task_t {
+			std::size_t disc;
+			const BDParser::playlist_item_t* item;
+			std::shared_ptr<BDParser::clip_info_t> clip_info;
+		};
+		std::vector<task_t> tasks;
+
+		for (std::size_t i = 0; i < discs.size(); i++) {
+			if (!discs[i].valid) {
+				continue;
+			}
+
+			const auto first_task = tasks.size();
+			for (const auto& playlist : discs[i].playlists) {
+				for (const auto& item : playlist.items) {
+					tasks.push_back({ i, &item, {} });
+				}
+			}
+
+			auto by_clip = [](const task_t& a, const task_t& b) {
+				return a.item->clip_id < b.item->clip_id;
+			};
+			std::sort(tasks.begin() + first_task, tasks.end(), by_clip);
+			tasks.erase(std::unique(tasks.begin() + first_task, tasks.end(), [](const task_t& a, const task_t& b) {
+				return a.item->clip_id == b.item->clip_id;
+			}), tasks.end());
+		}
+
+		parallel_for(tasks.size(), options.threads, [&](std::size_t i) {
+			auto clip_info = std::make_shared<BDParser::clip_info_t>();
+			if (BDParser::read_clip_info(tasks[i].item->clip_info_file_name(), *clip_info, options.reader_type)) {
+				clip_info->clip_id = tasks[i].item->clip_id;
+				tasks[i].clip_info = std::move(clip_info);
+			}
+		});
+
+		// Tasks are grouped by disc and sorted by clip, so every disc gets its clips in clip_id order
+		for (auto& task : tasks) {
+			if (task.clip_info) {
+				discs[task.disc].clips.emplace_back(std::move(task.clip_info));
+			}
+		}
+
+		for (auto& disc : discs) {
+			for (auto& playlist : disc.playlists) {
+				for (auto& item : playlist.items) {
+					auto clip = std::lower_bound(disc.clips.begin(), disc.clips.end(), item.clip_id, [](const auto& clip_info, uint32_t clip_id) {
+						return clip_info->clip_id < clip_id;
+					});
+					if (clip != disc.clips.end() && (*clip)->clip_id == item.clip_id) {
+						item.clip_info = *clip;
+					}
+				}
+			}
+		}
+	}
+
+	bool BDParser::parse(std::string_view path, bool skip_playlist_duplicate, bool check_m2ts_files, ReaderType reader_type)
+	{
+		options_t options;
+		options.skip_playlist_duplicate = skip_playlist_duplicate;
+		options.check_m2ts_files = check_m2ts_files;
+		options.reader_type = reader_type;
+
+		return parse(path, options);
+	}
+
+	bool BDParser::parse(std::string_view path, const options_t& options)
+	{
+		auto discs = parse_many({ std::string(path) }, options);
+		disc_ = std::move(discs.front());
+
+		return disc_.valid;
+	}
+
+	std::vector<BDParser::disc_t> BDParser::parse_many(const std::vector<std::string>& paths, const options_t& options)
+	{
+		// The fingerprint names content cache entries, otherwise it's computed on request only
+		const bool fingerprint = options.fingerprint || !options.content_cache_path.empty();
+
+		std::vector<disc_t> discs(paths.size());
+		std::vector<disc_state_t> states(paths.size());
+		parallel_for(paths.size(), options.threads, [&](std::size_t i) {
+			std::vector<playlist_file_t> playlist_files;
+			discs[i].path = paths[i];
+			discs[i].valid = collect_playlists(paths[i], playlist_files);
+
+			states[i].root_path = std::make_shared<const std::string>(paths[i]);
+
+			if (discs[i].valid && options.titles_only) {
+				discs[i].valid = read_titles(paths[i], states[i].titles);
+				for (const auto& title : states[i].titles) {
+					states[i].title_playlists.insert(title.playlist_ids.begin(), title.playlist_ids.end());
+					states[i].titles_hash = hash_combine(states[i].titles_hash, title.number);
+					for (const auto playlist_id : title.playlist_ids) {
+						states[i].titles_hash = hash_combine(states[i].titles_hash, playlist_id);
+					}
+				}
+			}
+
+			states[i].slots.resize(playlist_files.size());
+			for (std::size_t j = 0; j < playlist_files.size(); j++) {
+				states[i].slots[j].playlist_id = playlist_files[j].playlist_id;
+				states[i].slots[j].path = std::move(playlist_files[j].path);
+			}
+
+			if (discs[i].valid && !options.cache_path.empty() && make_cache_key(paths[i], states[i], options, states[i].cache_key)) {
+				states[i].metadata_cached = load_cache(cache_file_name(options.cache_path, paths[i]), states[i].cache_key, states[i]);
+				states[i].cached = states[i].metadata_cached;
+			}
+		});
+
+		if (!options.content_cache_path.empty()) {
+			// Hash the files of the discs that missed the parse cache and look their fingerprints up
+			struct task_t {
+				std::size_t disc;
+				std::size_t playlist;
+			};
+			std::vector<task_t> tasks;
+			for (std::size_t i = 0; i < paths.size(); i++) {
+				if (!discs[i].valid || states[i].cached) {
+					continue;
+				}
+
+				for (std::size_t j = 0; j < states[i].slots.size(); j++) {
+					tasks.push_back({ i, j });
+				}
+			}
+
+			parallel_for(tasks.size(), options.threads, [&](std::size_t i) {
+				auto& slot = states[tasks[i].disc].slots[tasks[i].playlist];
+				slot.hashed = hash_file(slot.path, slot.raw_hash);
+			});
+
+			parallel_for(paths.size(), options.threads, [&](std::size_t i) {
+				auto& state = states[i];
+				if (discs[i].valid && !state.cached && make_fingerprint(paths[i], state)) {
+					state.cached = load_cache(content_cache_file_name(options.content_cache_path, state.fingerprint),
+											  make_content_cache_key(state, options), state);
+				}
+			});
+		}
+
+		// Schedule the playlists of all discs on one pool, so a large disc doesn't hold up the others
+		struct task_t {
+			std::size_t disc;
+			std::size_t playlist;
+		};
+		std::vector<task_t> tasks;
+		for (std::size_t i = 0; i < paths.size(); i++) {
+			if (!discs[i].valid || states[i].cached) {
+				continue;
+			}
+
+			for (std::size_t j = 0; j < states[i].slots.size(); j++) {
+				// Playlists no title plays are left undecoded, they are still part of the fingerprint
+				if (options.titles_only && !states[i].title_playlists.contains(states[i].slots[j].playlist_id)) {
+					continue;
+				}
+				tasks.push_back({ i, j });
+			}
+		}
+
+		parallel_for(tasks.size(), options.threads, [&](std::size_t i) {
+			const auto [disc, playlist] = tasks[i];
+			auto& state = states[disc];
+			auto& slot = state.slots[playlist];
+
+			auto filter = [&](const uint8_t* data, std::size_t size) {
+				slot.raw_hash = hash_file_data(data, size);
+				slot.hashed = true;
+				if (!options.skip_playlist_duplicate) {
+					return true;
+				}
+
+				slot.claimed = true;
+				return claim_raw_playlist(state, playlist);
+			};
+			slot.valid = read_playlist(slot.path, state.root_path, options, filter, slot.playlist);
+			slot.playlist.playlist_id = slot.playlist_id;
+		});
+
+		if (fingerprint) {
+			// Hash the playlist files the decode pass didn't hold in memory: all of them with the stream reader,
+			// and under titles_only the ones no title plays
+			tasks.clear();
+			for (std::size_t i = 0; i < paths.size(); i++) {
+				if (!discs[i].valid || states[i].cached || states[i].fingerprinted) {
+					continue;
+				}
+
+				for (std::size_t j = 0; j < states[i].slots.size(); j++) {
+					if (!states[i].slots[j].hashed) {
+						tasks.push_back({ i, j });
+					}
+				}
+			}
+
+			parallel_for(tasks.size(), options.threads, [&](std::size_t i) {
+				auto& slot = states[tasks[i].disc].slots[tasks[i].playlist];
+				slot.hashed = hash_file(slot.path, slot.raw_hash);
+			});
+		}
+
+		parallel_for(paths.size(), options.threads, [&](std::size_t i) {
+			if (!discs[i].valid) {
+				return;
+			}
+
+			auto& state = states[i];
+			if (!state.cached) {
+				resolve_raw_duplicates(state, options.skip_playlist_duplicate);
+
+				if (fingerprint && !state.fingerprinted) {
+					std::ignore = make_fingerprint(paths[i], state);
+				}
+
+				if (state.fingerprinted && !options.content_cache_path.empty()) {
+					store_cache(options.content_cache_path, content_cache_file_name(options.content_cache_path, state.fingerprint),
+								make_content_cache_key(state, options), state);
+				}
+			}
+
+			if (state.cache_key && !state.metadata_cached) {
+				store_cache(options.cache_path, cache_file_name(options.cache_path, paths[i]), state.cache_key, state);
+			}
+
+			discs[i].fingerprint = state.fingerprint;
+			discs[i].titles = std::move(state.titles);
+			discs[i].valid = merge_playlists(state, options, discs[i]);
+		});
+
+		if (options.read_clips) {
+			read_clips(discs, options);
+		}
+
+		return discs;
+	}
+
+	bool BDParser::parse_top(std::string_view path, std::size_t count, pts_t min_duration, const options_t& options)
+	{
+		// Read durations only. Summaries skip byte-identical copies only, other duplicates can be told apart
+		// once the streams are known.
+		auto summary_options = options;
+		summary_options.summary_only = true;
+		summary_options.min_duration = std::max(options.min_duration, min_duration);
+		// Clips are read for the playlists that make the top only
+		summary_options.read_clips = false;
+
+		auto discs = parse_many({ std::string(path) }, summary_options);
+		disc_ = std::move(discs.front());
+		if (!disc_.valid) {
+			return false;
+		}
+
+		auto playlists = std::move(disc_.playlists);
+		disc_.playlists.clear();
+
+		std::vector<std::size_t> candidates(playlists.size());
+		std::iota(candidates.begin(), candidates.end(), 0);
+
+		// Max-heap by duration, equal durations in path order like the duplicate skipping of parse()
+		auto shorter = [&](std::size_t a, std::size_t b) {
+			const auto& playlist_a = playlists[a];
+			const auto& playlist_b = playlists[b];
+			return playlist_a.duration != playlist_b.duration ? playlist_a.duration < playlist_b.duration
+															  : playlist_a.mpls_file_name > playlist_b.mpls_file_name;
+		};
+		std::make_heap(candidates.begin(), candidates.end(), shorter);
+
+		// Fully read the longest playlists until the top is filled, shorter ones are never decoded
+		const bool skip_duplicates = options.skip_playlist_duplicate && !options.summary_only;
+		DuplicateFilter duplicates(skip_duplicates ? count : 0);
+		for (auto end = candidates.end(); disc_.playlists.size() < count && end != candidates.begin(); --end) {
+			std::pop_heap(candidates.begin(), end, shorter);
+
+			auto& playlist = playlists[*(end - 1)];
+			if (!options.summary_only && !read_streams(playlist, options.reader_type)) {
+				continue;
+			}
+
+			if (skip_duplicates && !duplicates.add(disc_.playlists, playlist)) {
+				continue;
+			}
+
+			disc_.playlists.emplace_back(std::move(playlist));
+		}
+
+		disc_.valid = !disc_.playlists.empty();
+
+		if (options.read_clips) {
+			read_clips({ &disc_, 1 }, options);
+		}
+
+		return disc_.valid;
+	}
+
+	bool BDParser::read_streams(playlist_t& playlist, ReaderType reader_type)
+	{
+		if (playlist.items.empty()) {
+			return false;
+		}
+
+		options_t options;
+		options.reader_type = reader_type;
+
+		playlist_t full_playlist;
+		if (!read_playlist(playlist.mpls_file_name, playlist.items.front().root_path, options,
+						   [](const uint8_t*, std::size_t) { return true; }, full_playlist)) {
+			return false;
+		}
+
+		playlist.streams = std::move(full_playlist.streams);
+		playlist.hash = playlist_hash(playlist);
+		playlist.summary = false;
+
+		return true;
+	}
+
+	bool BDParser::read_streams(std::size_t playlist_index, ReaderType reader_type)
+	{
+		return playlist_index < disc_.playlists.size() && read_streams(disc_.playlists[playlist_index], reader_type);
+	}
+
+	bool BDParser::read_clip_info(std::string_view path, clip_info_t& clip_info, ReaderType reader_type)
+	{
+		const std::string clip_info_path(path);
+
+		clip_info = {};
+		// Clip names are five digits followed by .clpi
+		if (clip_info_path.size() >= 10 && !read_clip_id(clip_info_path.data() + clip_info_path.size() - 10, clip_info.clip_id)) {
+			clip_info.clip_id = {};
+		}
+
+		switch (reader_type) {
+			case ReaderType::Stream:
+				return read_clip_info_file<StreamReader>(clip_info_path, clip_info);
+			case ReaderType::Mmap:
+				return read_clip_info_file<MmapReader>(clip_info_path, clip_info);
+			case ReaderType::Buffer:
+			default:
+				return read_clip_info_file<BufferReader>(clip_info_path, clip_info);
+		}
+	}
+
+	bool BDParser::clip_info_t::seek(pts_t pts, uint64_t& offset) const noexcept
+	{
+		if (ep_anchors.empty()) {
+			return false;
+		}
+
+		// 100 ns units to 45 kHz ticks, rounded so it is the inverse of to_pts()
+		const auto time = static_cast<uint32_t>(std::min<pts_t>((pts * 90 + 10000) / 20000, UINT32_MAX));
+
+		auto anchor = std::upper_bound(ep_anchors.begin(), ep_anchors.end(), time, [](uint32_t value, const ep_anchor_t& entry) {
+			return value < entry.pts;
+		});
+		if (anchor != ep_anchors.begin()) {
+			--anchor;
+		}
+
+		auto entry_pts = anchor->pts;
+		auto entry_spn = anchor->spn;
+		if (time > entry_pts) {
+			const auto deltas_end = (anchor + 1 != ep_anchors.end()) ? (anchor + 1)->deltas_offset : ep_deltas.size();
+			auto data = ep_deltas.data() + anchor->deltas_offset;
+			while (data != ep_deltas.data() + deltas_end) {
+				const auto pts_delta = read_varint(data);
+				const auto spn_delta = read_varint(data);
+				if (entry_pts + pts_delta > time) {
+					break;
+				}
+
+				entry_pts += pts_delta;
+				entry_spn += spn_delta;
+			}
+		}
+
+		offset = entry_spn * source_packet_size;
+
+		return true;
+	}
+
+	bool BDParser::playlist_t::locate(pts_t pts, std::size_t& item_index, pts_t& clip_pts) const noexcept
+	{
+		if (pts >= duration || item_start_times.size() != items.size() || items.empty()) {
+			return false;
+		}
+
+		auto it = std::upper_bound(item_start_times.begin(), item_start_times.end(), pts);
+		item_index = static_cast<std::size_t>(it - item_start_times.begin()) - 1;
+		clip_pts = items[item_index].start_pts + (pts - *(it - 1));
+
+		return true;
+	}
+
+	bool BDParser::playlist_t::chapter_at(pts_t time, std::size_t& mark_index) const noexcept
+	{
+		auto it = std::upper_bound(marks.begin(), marks.end(), time, [](pts_t value, const mark_t& mark) {
+			return value < mark.time;
+		});
+		while (it != marks.begin()) {
+			if ((--it)->type == MarkType::Entry) {
+				mark_index = static_cast<std::size_t>(it - marks.begin());
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool BDParser::playlist_t::next_chapter(pts_t time, std::size_t& mark_index) const noexcept
+	{
+		auto it = std::upper_bound(marks.begin(), marks.end(), time, [](pts_t value, const mark_t& mark) {
+			return value < mark.time;
+		});
+		for (; it != marks.end(); ++it) {
+			if (it->type == MarkType::Entry) {
+				mark_index = static_cast<std::size_t>(it - marks.begin());
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Writes the flat records field by field in little-endian order, so serialize() produces the same bytes
+	// on any host. Fields go at their offsets in the flat structs, padding is left zero.
+	class FlatWriter final
+	{
+		uint8_t* data_ = {};
+
+	public:
+		explicit FlatWriter(uint8_t* data) noexcept : data_(data) {}
+
+		template<typename T>
+		void write(T value) noexcept {
+			const auto bits = static_cast<uint64_t>(value);
+			for (std::size_t i = 0; i < sizeof(T); i++) {
+				*data_++ = static_cast<uint8_t>(bits >> (8 * i));
+			}
+		}
+
+		void write_buffer(const char* buffer, std::size_t size) noexcept {
+			std::memcpy(data_, buffer, size);
+			data_ += size;
+		}
+
+		void skip(std::size_t size) noexcept {
+			data_ += size;
+		}
+
+		void write(const flat::header_t& header) noexcept {
+			write_buffer(header.magic, sizeof(header.magic));
+			write(header.version);
+			write(header.fingerprint);
+			write(header.size);
+			write(header.root_offset);
+			write(header.root_size);
+			write(header.playlists_offset);
+			write(header.playlist_count);
+			write(header.items_offset);
+			write(header.item_count);
+			write(header.streams_offset);
+			write(header.stream_count);
+			write(header.marks_offset);
+			write(header.mark_count);
+			write(header.angle_clips_offset);
+			write(header.angle_clip_count);
+			write(header.strings_offset);
+			write(header.strings_size);
+			skip(sizeof(header.reserved));
+		}
+
+		void write(const flat::playlist_t& playlist) noexcept {
+			write(playlist.duration);
+			write(playlist.name_offset);
+			write(playlist.name_size);
+			write(playlist.first_item);
+			write(playlist.item_count);
+			write(playlist.first_stream);
+			write(playlist.stream_count);
+			write(playlist.first_mark);
+			write(playlist.mark_count);
+			write(playlist.first_angle_clip);
+			write(playlist.angle_clip_count);
+		}
+
+		void write(const flat::item_t& item) noexcept {
+			write(item.clip_id);
+			write(item.first_angle);
+			write(item.angle_count);
+			skip(sizeof(item.reserved));
+			write(item.start_pts);
+			write(item.end_pts);
+			write(item.start_time);
+		}
+
+		void write(const flat::stream_t& stream) noexcept {
+			write(stream.pid);
+			write(stream.type);
+			write_buffer(stream.lang_code.data(), stream.lang_code.size());
+			write(stream.video_format);
+			write(stream.frame_rate);
+			write(stream.aspect_ratio);
+			write(stream.channel_layout);
+			write(stream.sample_rate);
+			skip(sizeof(stream.reserved));
+		}
+
+		void write(const flat::mark_t& mark) noexcept {
+			write(mark.time);
+			write(mark.item_index);
+			write(mark.type);
+			skip(sizeof(mark.reserved));
+		}
+	};
+
+	std::vector<uint8_t> BDParser::serialize(const disc_t& disc)
+	{
+		auto align = [](std::size_t offset) {
+			return (offset + 7) & ~static_cast<std::size_t>(7);
+		};
+
+		std::size_t item_count = {};
+		std::size_t stream_count = {};
+		std::size_t mark_count = {};
+		std::size_t angle_clip_count = {};
+		std::size_t strings_size = disc.path.size();
+		for (const auto& playlist : disc.playlists) {
+			item_count += playlist.items.size();
+			stream_count += playlist.streams.size();
+			mark_count += playlist.marks.size();
+			angle_clip_count += playlist.angle_clip_ids.size();
+			strings_size += playlist.mpls_file_name.size();
+		}
+
+		flat::header_t header = {};
+		std::memcpy(header.magic, flat::magic, sizeof(header.magic));
+		header.version = flat::version;
+		header.fingerprint = disc.fingerprint;
+		header.root_size = static_cast<uint32_t>(disc.path.size());
+		header.playlists_offset = static_cast<uint32_t>(sizeof(header));
+		header.playlist_count = static_cast<uint32_t>(disc.playlists.size());
+		header.items_offset = static_cast<uint32_t>(align(header.playlists_offset + disc.playlists.size() * sizeof(flat::playlist_t)));
+		header.item_count = static_cast<uint32_t>(item_count);
+		header.streams_offset = static_cast<uint32_t>(align(header.items_offset + item_count * sizeof(flat::item_t)));
+		header.stream_count = static_cast<uint32_t>(stream_count);
+		header.marks_offset = static_cast<uint32_t>(align(header.streams_offset + stream_count * sizeof(flat::stream_t)));
+		header.mark_count = static_cast<uint32_t>(mark_count);
+		header.angle_clips_offset = static_cast<uint32_t>(align(header.marks_offset + mark_count * sizeof(flat::mark_t)));
+		header.angle_clip_count = static_cast<uint32_t>(angle_clip_count);
+		header.strings_offset = static_cast<uint32_t>(align(header.angle_clips_offset + angle_clip_count * sizeof(uint32_t)));
+		header.strings_size = static_cast<uint32_t>(strings_size);
+		header.size = static_cast<uint32_t>(align(header.strings_offset + strings_size));
+
+		std::vector<uint8_t> buffer(header.size);
+		FlatWriter(buffer.data()).write(header);
+
+		FlatWriter playlist_writer(buffer.data() + header.playlists_offset);
+		FlatWriter item_writer(buffer.data() + header.items_offset);
+		FlatWriter stream_writer(buffer.data() + header.streams_offset);
+		FlatWriter mark_writer(buffer.data() + header.marks_offset);
+		FlatWriter angle_clip_writer(buffer.data() + header.angle_clips_offset);
+		auto string_data = buffer.data() + header.strings_offset;
+
+		uint32_t string_offset = header.root_size;
+		std::memcpy(string_data, disc.path.data(), disc.path.size());
+
+		uint32_t first_item = {};
+		uint32_t first_stream = {};
+		uint32_t first_mark = {};
+		uint32_t first_angle_clip = {};
+		for (const auto& playlist : disc.playlists) {
+			flat::playlist_t flat_playlist = {};
+			flat_playlist.duration = playlist.duration;
+			flat_playlist.name_offset = string_offset;
+			flat_playlist.name_size = static_cast<uint32_t>(playlist.mpls_file_name.size());
+			flat_playlist.first_item = first_item;
+			flat_playlist.item_count = static_cast<uint32_t>(playlist.items.size());
+			flat_playlist.first_stream = first_stream;
+			flat_playlist.stream_count = static_cast<uint32_t>(playlist.streams.size());
+			flat_playlist.first_mark = first_mark;
+			flat_playlist.mark_count = static_cast<uint32_t>(playlist.marks.size());
+			flat_playlist.first_angle_clip = first_angle_clip;
+			flat_playlist.angle_clip_count = static_cast<uint32_t>(playlist.angle_clip_ids.size());
+
+			playlist_writer.write(flat_playlist);
+
+			std::memcpy(string_data + string_offset, playlist.mpls_file_name.data(), playlist.mpls_file_name.size());
+			string_offset += flat_playlist.name_size;
+
+			for (const auto& item : playlist.items) {
+				flat::item_t flat_item = {};
+				flat_item.clip_id = item.clip_id;
+				flat_item.first_angle = item.first_angle;
+				flat_item.angle_count = item.angle_count;
+				flat_item.start_pts = item.start_pts;
+				flat_item.end_pts = item.end_pts;
+				flat_item.start_time = item.start_time;
+
+				item_writer.write(flat_item);
+			}
+			first_item += flat_playlist.item_count;
+
+			for (const auto& stream : playlist.streams) {
+				flat::stream_t flat_stream = {};
+				flat_stream.pid = stream.pid;
+				flat_stream.type = stream.type;
+				flat_stream.lang_code = stream.lang_code;
+				flat_stream.video_format = stream.video_format;
+				flat_stream.frame_rate = stream.frame_rate;
+				flat_stream.aspect_ratio = stream.aspect_ratio;
+				flat_stream.channel_layout = stream.channel_layout;
+				flat_stream.sample_rate = stream.sample_rate;
+
+				stream_writer.write(flat_stream);
+			}
+			first_stream += flat_playlist.stream_count;
+
+			for (const auto& mark : playlist.marks) {
+				flat::mark_t flat_mark = {};
+				flat_mark.time = mark.time;
+				flat_mark.item_index = mark.item_index;
+				flat_mark.type = mark.type;
+
+				mark_writer.write(flat_mark);
+			}
+			first_mark += flat_playlist.mark_count;
+
+			for (const auto angle_clip_id : playlist.angle_clip_ids) {
+				angle_clip_writer.write(angle_clip_id);
+			}
+			first_angle_clip += flat_playlist.angle_clip_count;
+		}
+
+		return buffer;
+	}
+}
\ No newline at end of file
@@ -1,7 +1,11 @@
 ﻿#ifndef BDPARSER_HPP
 #define BDPARSER_HPP
 
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -11,7 +15,7 @@
 namespace parser {
 	using pts_t = uint64_t;
 
-	enum class StreamType {
+	enum class StreamType : uint8_t {
 		Unknown                  = 0,
 		MPEG1_VIDEO              = 0x01,
 		MPEG2_VIDEO              = 0x02,
@@ -37,7 +41,7 @@ namespace parser {
 		SUBTITLE                 = 0x92
 	};
 
-	enum class VideoFormat {
+	enum class VideoFormat : uint8_t {
 		Unknown           = 0,
 		VideoFormat_480i  = 1,
 		VideoFormat_576i  = 2,
@@ -49,7 +53,7 @@ namespace parser {
 		VideoFormat_2160p = 8,
 	};
 
-	enum class FrameRate {
+	enum class FrameRate : uint8_t {
 		Unknown          = 0,
 		FrameRate_23_976 = 1,
 		FrameRate_24     = 2,
@@ -59,14 +63,14 @@ namespace parser {
 		FrameRate_59_94  = 7
 	};
 
-	enum class AspectRatio {
+	enum class AspectRatio : uint8_t {
 		Unknown          = 0,
 		AspectRatio_4_3  = 2,
 		AspectRatio_16_9 = 3,
 		AspectRatio_2_21 = 4
 	};
 
-	enum class ChannelLayout {
+	enum class ChannelLayout : uint8_t {
 		Unknown              = 0,
 		ChannelLayout_MONO   = 1,
 		ChannelLayout_STEREO = 3,
@@ -74,7 +78,7 @@ namespace parser {
 		ChannelLayout_COMBO  = 12
 	};
 
-	enum class SampleRate {
+	enum class SampleRate : uint8_t {
 		Unknown           = 0,
 		SampleRate_48     = 1,
 		SampleRate_96     = 4,
@@ -83,15 +87,25 @@ namespace parser {
 		SampleRate_48_96  = 14
 	};
 
-	enum class StreamFormat {
+	enum class StreamFormat : uint8_t {
 		Video,
 		Audio,
 		Subtitles
 	};
 
-	class BDParser final {
-		bool parse_playlist(const std::string& playlist_path, std::string_view root_path, bool skip_playlist_duplicate, bool check_m2ts_files) noexcept;
+	enum class MarkType : uint8_t {
+		Unknown   = 0,
+		Entry     = 1, // chapter
+		LinkPoint = 2
+	};
+
+	enum class ReaderType {
+		Stream, // std::ifstream, field by field
+		Buffer, // whole file read into memory
+		Mmap    // read-only file mapping
+	};
 
+	class BDParser final {
 	public:
 		BDParser() = default;
 		BDParser(BDParser&&) = delete;
@@ -100,12 +114,46 @@ namespace parser {
 		BDParser& operator=(const BDParser&) = delete;
 		~BDParser() = default;
 
-		[[nodiscard]] bool parse(std::string_view path, bool skip_playlist_duplicate, bool check_m2ts_files);
+		struct options_t {
+			bool skip_playlist_duplicate = false;
+			bool check_m2ts_files = false;
+			ReaderType reader_type = ReaderType::Buffer;
+
+			// Number of threads used to read playlists, 0 - one per hardware thread
+			unsigned threads = 1;
+
+			// Read only the playlist header and the item times, streams are read later with read_streams().
+			// Duplicate skipping then drops byte-identical playlist files only, as playlists that differ in
+			// their streams alone can't be told apart yet.
+			bool summary_only = false;
+
+			// Playlists shorter than this are dropped as soon as their item times are read
+			pts_t min_duration = {};
+
+			// Read the clip info of every clip used by the result, each clip is decoded once per disc
+			bool read_clips = false;
+
+			// Decode only the playlists played by the titles of index.bdmv, see disc_t::titles
+			bool titles_only = false;
+
+			// Compute disc_t::fingerprint, which hashes every playlist file including those that aren't decoded.
+			// Always done when content_cache_path is set.
+			bool fingerprint = false;
+
+			// Directory for cached parse results, empty - no cache
+			std::string cache_path;
+			// Directory for parse results shared by all copies of a disc, empty - no cache
+			std::string content_cache_path;
+		};
+
+		[[nodiscard]] bool parse(std::string_view path, bool skip_playlist_duplicate, bool check_m2ts_files, ReaderType reader_type = ReaderType::Buffer);
+		[[nodiscard]] bool parse(std::string_view path, const options_t& options);
 
 		struct stream_t {
 			uint16_t pid = {};
 			StreamType type = {};
-			std::string lang_code;
+			// ISO 639-2 code, all zeros when the stream has no language
+			std::array<char, 3> lang_code = {};
 
 			// Valid for video types
 			VideoFormat video_format = {};
@@ -116,6 +164,10 @@ namespace parser {
 			ChannelLayout channel_layout = {};
 			SampleRate sample_rate = {};
 
+			std::string_view language() const noexcept {
+				return lang_code[0] ? std::string_view(lang_code.data(), lang_code.size()) : std::string_view();
+			}
+
 			StreamFormat format() const noexcept {
 				if (video_format != VideoFormat::Unknown) {
 					return StreamFormat::Video;
@@ -132,41 +184,390 @@ namespace parser {
 					channel_layout == other.channel_layout && sample_rate == other.sample_rate;
 			}
 		};
+		static_assert(sizeof(stream_t) <= 16);
+
+		// Clip information read from CLIPINF/xxxxx.clpi
+		struct clip_info_t {
+			// Number of the STREAM/xxxxx.M2TS clip
+			uint32_t clip_id = {};
+
+			// Streams of the clip from its program info, unlike the playlist streams these include
+			// the aspect ratio of video streams
+			std::vector<stream_t> streams;
+
+			// PID of the stream the entry points belong to, usually the main video
+			uint16_t ep_pid = {};
+
+			// Entry points of the EP map. Every ep_block_size-th entry is stored in full and the entries
+			// in between as varint deltas from the previous one, so a lookup is a binary search over the
+			// anchors followed by a short linear decode.
+			static constexpr std::size_t ep_block_size = 16;
+
+			struct ep_anchor_t {
+				// Clip PTS in 45 kHz ticks
+				uint32_t pts;
+				// Source packet number
+				uint32_t spn;
+				// Start of the deltas following this entry in ep_deltas
+				uint32_t deltas_offset;
+			};
+
+			std::vector<ep_anchor_t> ep_anchors;
+			std::vector<uint8_t> ep_deltas;
+			std::size_t ep_count = {};
+
+			// Byte offset in the M2TS of the last entry point at or before pts, which is a clip time
+			// like playlist_item_t::start_pts. Returns false when the clip has no entry points.
+			[[nodiscard]] bool seek(pts_t pts, uint64_t& offset) const noexcept;
+		};
 
 		struct playlist_item_t {
-			std::string file_name;
+			// BD/BDMV root shared by all items of a disc
+			std::shared_ptr<const std::string> root_path;
+			// Number of the STREAM/xxxxx.M2TS clip
+			uint32_t clip_id = {};
+			// Clips of the other angles, a range of playlist_t::angle_clip_ids
+			uint16_t first_angle = {};
+			uint8_t angle_count = {};
 
 			pts_t start_pts = {};
 			pts_t end_pts = {};
 			pts_t start_time = {};
 
+			// Shared by all items using the clip, set with options_t::read_clips when the clip info could be read
+			std::shared_ptr<const clip_info_t> clip_info;
+
+			std::string file_name() const {
+				return std::format("{}/STREAM/{:05}.M2TS", root_path ? std::string_view(*root_path) : std::string_view(), clip_id);
+			}
+
+			std::string clip_info_file_name() const {
+				return std::format("{}/CLIPINF/{:05}.clpi", root_path ? std::string_view(*root_path) : std::string_view(), clip_id);
+			}
+
 			bool operator==(const playlist_item_t& other) const {
-				return file_name == other.file_name &&
+				return clip_id == other.clip_id && angle_count == other.angle_count &&
 					start_pts == other.start_pts && end_pts == other.end_pts &&
 					start_time == other.start_time;
 			}
 		};
 
+		// PlayListMark entry
+		struct mark_t {
+			// Playlist time
+			pts_t time = {};
+			// Item the mark points into
+			uint16_t item_index = {};
+			MarkType type = {};
+
+			bool operator==(const mark_t& other) const {
+				return time == other.time && item_index == other.item_index && type == other.type;
+			}
+		};
+
 		struct playlist_t {
 			std::string mpls_file_name;
+			// Number of the PLAYLIST/xxxxx.mpls file
+			uint32_t playlist_id = {};
 			pts_t duration = {};
 
 			std::vector<playlist_item_t> items;
 			std::vector<stream_t> streams;
 
+			// Clips of the second and further angles of all items, see angle_clips()
+			std::vector<uint32_t> angle_clip_ids;
+
+			// start_time of every item, kept contiguous for locate()
+			std::vector<pts_t> item_start_times;
+
+			// Marks sorted by time, chapters are the MarkType::Entry ones
+			std::vector<mark_t> marks;
+
+			// Structural hash of the fields compared by operator==
+			uint64_t hash = {};
+
+			// Read with options_t::summary_only, streams are empty until read_streams() is called
+			bool summary = false;
+
+			// Clips of the angles after the first of a multi-angle item, empty for single angle items
+			std::span<const uint32_t> angle_clips(const playlist_item_t& item) const noexcept {
+				return std::span<const uint32_t>(angle_clip_ids).subspan(item.first_angle, item.angle_count);
+			}
+
+			// Item playing at a playlist time and the matching clip time, false when pts is past the end
+			[[nodiscard]] bool locate(pts_t pts, std::size_t& item_index, pts_t& clip_pts) const noexcept;
+
+			// Index in marks of the chapter playing at a playlist time, false before the first chapter
+			[[nodiscard]] bool chapter_at(pts_t time, std::size_t& mark_index) const noexcept;
+			// Index in marks of the first chapter after a playlist time, false when there is none
+			[[nodiscard]] bool next_chapter(pts_t time, std::size_t& mark_index) const noexcept;
+
 			bool operator==(const playlist_t& other) const {
-				return duration == other.duration && items == other.items && streams == other.streams;
+				return duration == other.duration && items == other.items && streams == other.streams &&
+					angle_clip_ids == other.angle_clip_ids && marks == other.marks;
 			}
 		};
 
+		// Title of index.bdmv
+		struct title_t {
+			// Title number, starting at 1
+			uint16_t number = {};
+			// HDMV title, BD-J titles have no playlists that can be read from the disc structure
+			bool hdmv = false;
+			// PLAYLIST/xxxxx.mpls numbers played by the movie object of the title and the objects it jumps to
+			std::vector<uint32_t> playlist_ids;
+		};
+
+		struct disc_t {
+			std::string path;
+			bool valid = false;
+
+			std::vector<playlist_t> playlists;
+
+			// Playlist files skipped without decoding as byte-identical copies of an earlier file
+			std::size_t raw_duplicates = {};
+
+			// Hash of the contents of index.bdmv and the playlist files, the same for every copy of a disc.
+			// Filled with options_t::fingerprint or options_t::content_cache_path, zero otherwise.
+			uint64_t fingerprint = {};
+
+			// Clips used by the playlists sorted by clip_id, filled with options_t::read_clips
+			std::vector<std::shared_ptr<const clip_info_t>> clips;
+
+			// Titles in index.bdmv order, filled with options_t::titles_only
+			std::vector<title_t> titles;
+		};
+
+		// Parses several BD/BDMV roots on one thread pool, disc_t::valid is false for the roots that failed
+		[[nodiscard]] static std::vector<disc_t> parse_many(const std::vector<std::string>& paths, const options_t& options);
+
+		// Parses only the count longest playlists of at least min_duration, sorted by duration.
+		// Durations are read first and only the playlists that can make the top are fully decoded.
+		[[nodiscard]] bool parse_top(std::string_view path, std::size_t count, pts_t min_duration, const options_t& options);
+
+		// Reads the streams of a playlist parsed with options_t::summary_only
+		[[nodiscard]] static bool read_streams(playlist_t& playlist, ReaderType reader_type = ReaderType::Buffer);
+		[[nodiscard]] bool read_streams(std::size_t playlist_index, ReaderType reader_type = ReaderType::Buffer);
+
+		// Reads a CLIPINF/xxxxx.clpi file
+		[[nodiscard]] static bool read_clip_info(std::string_view path, clip_info_t& clip_info, ReaderType reader_type = ReaderType::Buffer);
+
+		// Flat serialization of a parse result, see flat::ResultView
+		[[nodiscard]] static std::vector<uint8_t> serialize(const disc_t& disc);
+		[[nodiscard]] std::vector<uint8_t> serialize() const {
+			return serialize(disc_);
+		}
+
 	private:
-		std::vector<playlist_t> playlists_;
+		disc_t disc_;
 
 	public:
 		const std::vector<playlist_t>& playlists() noexcept {
-			return playlists_;
+			return disc_.playlists;
+		}
+
+		std::size_t raw_duplicates() const noexcept {
+			return disc_.raw_duplicates;
+		}
+
+		uint64_t fingerprint() const noexcept {
+			return disc_.fingerprint;
+		}
+
+		const std::vector<std::shared_ptr<const clip_info_t>>& clips() const noexcept {
+			return disc_.clips;
+		}
+
+		const std::vector<title_t>& titles() const noexcept {
+			return disc_.titles;
 		}
 	};
+
+	// Flat result format written by BDParser::serialize(). It holds fixed size little-endian records
+	// addressed by offsets from the start of the data and a string table, so it can be mapped by
+	// another process and read in place. ResultView reads the records in place and therefore only
+	// accepts the data on little-endian hosts.
+	namespace flat {
+		constexpr char magic[4] = { 'B', 'D', 'P', 'R' };
+		constexpr uint32_t version = 3;
+
+		struct header_t {
+			char magic[4];
+			uint32_t version;
+			uint64_t fingerprint;
+			uint32_t size;
+
+			// Root path, in the string table
+			uint32_t root_offset;
+			uint32_t root_size;
+
+			uint32_t playlists_offset;
+			uint32_t playlist_count;
+			uint32_t items_offset;
+			uint32_t item_count;
+			uint32_t streams_offset;
+			uint32_t stream_count;
+			uint32_t marks_offset;
+			uint32_t mark_count;
+			uint32_t angle_clips_offset;
+			uint32_t angle_clip_count;
+			uint32_t strings_offset;
+			uint32_t strings_size;
+			uint32_t reserved;
+		};
+		static_assert(sizeof(header_t) == 80);
+
+		struct playlist_t {
+			pts_t duration;
+
+			// .mpls path, in the string table
+			uint32_t name_offset;
+			uint32_t name_size;
+
+			// Ranges in the item and stream arrays
+			uint32_t first_item;
+			uint32_t item_count;
+			uint32_t first_stream;
+			uint32_t stream_count;
+			uint32_t first_mark;
+			uint32_t mark_count;
+			// Clips of the second and further angles of all items, item_t::first_angle is relative to it
+			uint32_t first_angle_clip;
+			uint32_t angle_clip_count;
+		};
+		static_assert(sizeof(playlist_t) == 48);
+
+		struct item_t {
+			uint32_t clip_id;
+			uint16_t first_angle;
+			uint8_t angle_count;
+			uint8_t reserved;
+			pts_t start_pts;
+			pts_t end_pts;
+			pts_t start_time;
+		};
+		static_assert(sizeof(item_t) == 32);
+
+		struct stream_t {
+			uint16_t pid;
+			StreamType type;
+			std::array<char, 3> lang_code;
+			VideoFormat video_format;
+			FrameRate frame_rate;
+			AspectRatio aspect_ratio;
+			ChannelLayout channel_layout;
+			SampleRate sample_rate;
+			uint8_t reserved[5];
+		};
+		static_assert(sizeof(stream_t) == 16);
+
+		// PlayListMark entry, sorted by time within a playlist
+		struct mark_t {
+			pts_t time;
+			uint16_t item_index;
+			MarkType type;
+			uint8_t reserved[5];
+		};
+		static_assert(sizeof(mark_t) == 16);
+
+		class ResultView final {
+			const uint8_t* data_ = {};
+			const header_t* header_ = {};
+
+			template<typename T>
+			static bool check_range(uint64_t offset, uint64_t count, uint64_t size) noexcept {
+				return offset % alignof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+			}
+
+		public:
+			// The data must stay mapped while the view is used and be aligned to 8 bytes
+			ResultView(const void* data, std::size_t size) noexcept {
+				if (std::endian::native != std::endian::little ||
+						!data || reinterpret_cast<uintptr_t>(data) % alignof(header_t) || size < sizeof(header_t)) {
+					return;
+				}
+
+				auto bytes = static_cast<const uint8_t*>(data);
+				auto header = reinterpret_cast<const header_t*>(bytes);
+				if (std::string_view(header->magic, sizeof(header->magic)) != std::string_view(magic, sizeof(magic)) ||
+						header->version != version || header->size > size ||
+						!check_range<playlist_t>(header->playlists_offset, header->playlist_count, header->size) ||
+						!check_range<item_t>(header->items_offset, header->item_count, header->size) ||
+						!check_range<stream_t>(header->streams_offset, header->stream_count, header->size) ||
+						!check_range<mark_t>(header->marks_offset, header->mark_count, header->size) ||
+						!check_range<uint32_t>(header->angle_clips_offset, header->angle_clip_count, header->size) ||
+						!check_range<char>(header->strings_offset, header->strings_size, header->size) ||
+						static_cast<uint64_t>(header->root_offset) + header->root_size > header->strings_size) {
+					return;
+				}
+
+				auto playlists = reinterpret_cast<const playlist_t*>(bytes + header->playlists_offset);
+				auto items = reinterpret_cast<const item_t*>(bytes + header->items_offset);
+				for (uint32_t i = 0; i < header->playlist_count; i++) {
+					const auto& playlist = playlists[i];
+					if (static_cast<uint64_t>(playlist.name_offset) + playlist.name_size > header->strings_size ||
+							static_cast<uint64_t>(playlist.first_item) + playlist.item_count > header->item_count ||
+							static_cast<uint64_t>(playlist.first_stream) + playlist.stream_count > header->stream_count ||
+							static_cast<uint64_t>(playlist.first_mark) + playlist.mark_count > header->mark_count ||
+							static_cast<uint64_t>(playlist.first_angle_clip) + playlist.angle_clip_count > header->angle_clip_count) {
+						return;
+					}
+
+					for (uint32_t j = 0; j < playlist.item_count; j++) {
+						const auto& item = items[playlist.first_item + j];
+						if (static_cast<uint64_t>(item.first_angle) + item.angle_count > playlist.angle_clip_count) {
+							return;
+						}
+					}
+				}
+
+				data_ = bytes;
+				header_ = header;
+			}
+
+			bool valid() const noexcept {
+				return header_ != nullptr;
+			}
+
+			uint64_t fingerprint() const noexcept {
+				return header_->fingerprint;
+			}
+
+			std::string_view root_path() const noexcept {
+				return string(header_->root_offset, header_->root_size);
+			}
+
+			std::span<const playlist_t> playlists() const noexcept {
+				return { reinterpret_cast<const playlist_t*>(data_ + header_->playlists_offset), header_->playlist_count };
+			}
+
+			std::string_view mpls_file_name(const playlist_t& playlist) const noexcept {
+				return string(playlist.name_offset, playlist.name_size);
+			}
+
+			std::span<const item_t> items(const playlist_t& playlist) const noexcept {
+				return { reinterpret_cast<const item_t*>(data_ + header_->items_offset) + playlist.first_item, playlist.item_count };
+			}
+
+			std::span<const stream_t> streams(const playlist_t& playlist) const noexcept {
+				return { reinterpret_cast<const stream_t*>(data_ + header_->streams_offset) + playlist.first_stream, playlist.stream_count };
+			}
+
+			std::span<const mark_t> marks(const playlist_t& playlist) const noexcept {
+				return { reinterpret_cast<const mark_t*>(data_ + header_->marks_offset) + playlist.first_mark, playlist.mark_count };
+			}
+
+			// Clips of the angles after the first of a multi-angle item, empty for single angle items
+			std::span<const uint32_t> angle_clips(const playlist_t& playlist, const item_t& item) const noexcept {
+				return { reinterpret_cast<const uint32_t*>(data_ + header_->angle_clips_offset) + playlist.first_angle_clip + item.first_angle, item.angle_count };
+			}
+
+		private:
+			std::string_view string(uint32_t offset, uint32_t size) const noexcept {
+				return { reinterpret_cast<const char*>(data_ + header_->strings_offset) + offset, size };
+			}
+		};
+	} // namespace flat
 } // namespace parser
 
 // format helpers
@@ -293,8 +694,8 @@ public:
 		auto info = std::format("PID : {}, type : {} ({}{})",
 							   stream.pid, stream.type, stream.format(),
 							   stream.format() == parser::StreamFormat::Video ? std::format(" {}@{}", stream.video_format, stream.frame_rate) : "");
-		if (!stream.lang_code.empty()) {
-			info += std::format(", language : {}", stream.lang_code);
+		if (!stream.language().empty()) {
+			info += std::format(", language : {}", stream.language());
 		}
 		return std::formatter<std::string_view>::format(info, ctx);
 	}
@@ -0,0 +1,901 @@
+﻿#ifndef BDPARSER_DECODERS_HPP
+#define BDPARSER_DECODERS_HPP
+
+// Readers, the MPLS decoders and the disc file listing shared by BDParser.cpp and the benchmark.
+// Internal to the library, not part of its interface.
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <tuple>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "BDParser.hpp"
+
+namespace parser {
+	[[nodiscard]] inline uint16_t swap_uint16(uint16_t value) noexcept
+	{
+		return (value << 8) | (value >> 8);
+	}
+
+	[[nodiscard]] inline uint32_t swap_uint32(uint32_t value) noexcept
+	{
+		value = ((value << 8) & 0xFF00FF00) | ((value >> 8) & 0xFF00FF);
+		return (value << 16) | (value >> 16);
+	}
+
+	class IReader {
+	public:
+		IReader() = default;
+		IReader(IReader&&) = delete;
+		IReader(const IReader&) = delete;
+		IReader& operator=(IReader&&) = delete;
+		IReader& operator=(const IReader&) = delete;
+		virtual ~IReader() = default;
+
+		[[nodiscard]] virtual bool open(const std::string& path) = 0;
+		virtual void read_buffer(char* buffer, std::size_t size, std::error_code& ec) = 0;
+		[[nodiscard]] virtual uint32_t read_uint32(std::error_code& ec) = 0;
+		[[nodiscard]] virtual uint16_t read_uint16(std::error_code& ec) = 0;
+		[[nodiscard]] virtual uint8_t read_uint8(std::error_code& ec) = 0;
+		virtual void skip(std::size_t size, std::error_code& ec) = 0;
+		virtual void seek(std::size_t pos, std::error_code& ec) = 0;
+		[[nodiscard]] virtual size_t position(std::error_code& ec) = 0;
+	};
+
+	class StreamReader final : public IReader
+	{
+		std::ifstream stream_;
+
+	public:
+		explicit StreamReader(const std::string& path, std::error_code& ec) {
+			if (!open(path)) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		[[nodiscard]] bool open(const std::string& path) override {
+			stream_.open(path, std::ios::in | std::ios::binary);
+			return stream_.is_open();
+		}
+
+		void read_buffer(char* buffer, std::size_t size, std::error_code& ec) noexcept override {
+			stream_.read(buffer, size);
+			if (stream_.fail()) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		[[nodiscard]] uint32_t read_uint32(std::error_code& ec) noexcept override {
+			uint32_t value = {};
+			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
+			if (ec) {
+				return {};
+			}
+
+			return swap_uint32(value);
+		}
+
+		[[nodiscard]] uint16_t read_uint16(std::error_code& ec) noexcept override {
+			uint16_t value = {};
+			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
+			if (ec) {
+				return {};
+			}
+
+			return swap_uint16(value);
+		}
+
+		[[nodiscard]] uint8_t read_uint8(std::error_code& ec) noexcept override {
+			uint8_t value = {};
+			read_buffer(reinterpret_cast<char*>(&value), sizeof(value), ec);
+			return value;
+		}
+
+		void skip(std::size_t size, std::error_code& ec) noexcept override {
+			stream_.seekg(size, std::ios_base::cur);
+			if (stream_.fail()) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		void seek(std::size_t pos, std::error_code& ec) noexcept override {
+			stream_.seekg(pos);
+			if (stream_.fail()) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		size_t position(std::error_code& ec) noexcept override {
+			auto position = stream_.tellg();
+			if (stream_.fail()) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+
+			return position;
+		}
+	};
+
+	class MemoryReader : public IReader
+	{
+	protected:
+		const uint8_t* data_ = {};
+		std::size_t size_ = {};
+		std::size_t position_ = {};
+
+		[[nodiscard]] bool available(std::size_t size, std::error_code& ec) noexcept {
+			if (size > size_ - position_) {
+				ec = std::make_error_code(std::io_errc::stream);
+				return false;
+			}
+
+			return true;
+		}
+
+	public:
+		[[nodiscard]] const uint8_t* data() const noexcept {
+			return data_;
+		}
+
+		[[nodiscard]] std::size_t size() const noexcept {
+			return size_;
+		}
+
+		void read_buffer(char* buffer, std::size_t size, std::error_code& ec) noexcept final {
+			if (!available(size, ec)) {
+				return;
+			}
+
+			std::memcpy(buffer, data_ + position_, size);
+			position_ += size;
+		}
+
+		[[nodiscard]] uint32_t read_uint32(std::error_code& ec) noexcept final {
+			if (!available(4, ec)) {
+				return {};
+			}
+
+			const auto data = data_ + position_;
+			position_ += 4;
+
+			return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+				   (static_cast<uint32_t>(data[2]) << 8) | data[3];
+		}
+
+		[[nodiscard]] uint16_t read_uint16(std::error_code& ec) noexcept final {
+			if (!available(2, ec)) {
+				return {};
+			}
+
+			const auto data = data_ + position_;
+			position_ += 2;
+
+			return static_cast<uint16_t>((data[0] << 8) | data[1]);
+		}
+
+		[[nodiscard]] uint8_t read_uint8(std::error_code& ec) noexcept final {
+			if (!available(1, ec)) {
+				return {};
+			}
+
+			return data_[position_++];
+		}
+
+		void skip(std::size_t size, std::error_code& ec) noexcept final {
+			if (available(size, ec)) {
+				position_ += size;
+			}
+		}
+
+		void seek(std::size_t pos, std::error_code& ec) noexcept final {
+			if (pos > size_) {
+				ec = std::make_error_code(std::io_errc::stream);
+				return;
+			}
+
+			position_ = pos;
+		}
+
+		[[nodiscard]] size_t position(std::error_code&) noexcept final {
+			return position_;
+		}
+	};
+
+	class BufferReader final : public MemoryReader
+	{
+		std::vector<uint8_t> buffer_;
+
+	public:
+		explicit BufferReader(const std::string& path, std::error_code& ec) {
+			if (!open(path)) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		[[nodiscard]] bool open(const std::string& path) override {
+			buffer_.clear();
+			data_ = {};
+			size_ = position_ = {};
+
+			std::ifstream stream(path, std::ios::in | std::ios::binary | std::ios::ate);
+			if (!stream.is_open()) {
+				return false;
+			}
+
+			const auto size = stream.tellg();
+			if (size <= 0) {
+				return false;
+			}
+
+			buffer_.resize(static_cast<std::size_t>(size));
+			stream.seekg(0);
+			stream.read(reinterpret_cast<char*>(buffer_.data()), size);
+			if (stream.fail()) {
+				return false;
+			}
+
+			data_ = buffer_.data();
+			size_ = buffer_.size();
+
+			return true;
+		}
+	};
+
+	class MmapReader final : public MemoryReader
+	{
+#ifdef _WIN32
+		HANDLE mapping_ = {};
+#endif
+
+		void close() noexcept {
+			if (data_) {
+#ifdef _WIN32
+				UnmapViewOfFile(data_);
+				CloseHandle(mapping_);
+				mapping_ = {};
+#else
+				munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+			}
+
+			data_ = {};
+			size_ = position_ = {};
+		}
+
+	public:
+		explicit MmapReader(const std::string& path, std::error_code& ec) {
+			if (!open(path)) {
+				ec = std::make_error_code(std::io_errc::stream);
+			}
+		}
+
+		~MmapReader() override {
+			close();
+		}
+
+		[[nodiscard]] bool open(const std::string& path) override {
+			close();
+
+#ifdef _WIN32
+			auto file = CreateFileW(std::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+									OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			LARGE_INTEGER size = {};
+			if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+				CloseHandle(file);
+				return false;
+			}
+
+			mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping_) {
+				return false;
+			}
+
+			auto data = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+			if (!data) {
+				CloseHandle(mapping_);
+				mapping_ = {};
+				return false;
+			}
+
+			data_ = static_cast<const uint8_t*>(data);
+			size_ = static_cast<std::size_t>(size.QuadPart);
+#else
+			auto fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+
+			struct stat st = {};
+			if (fstat(fd, &st) || st.st_size <= 0) {
+				::close(fd);
+				return false;
+			}
+
+			auto data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (data == MAP_FAILED) {
+				return false;
+			}
+
+			data_ = static_cast<const uint8_t*>(data);
+			size_ = static_cast<std::size_t>(st.st_size);
+#endif
+
+			return true;
+		}
+	};
+
+	template<typename Reader>
+	[[nodiscard]] uint64_t read_uint64(Reader& reader, std::error_code& ec)
+	{
+		const uint64_t value = reader.read_uint32(ec);
+		return (value << 32) | reader.read_uint32(ec);
+	}
+
+	// PIDs are 13 bits, so the streams already added to a playlist are tracked in a bitset
+	using pid_set_t = std::bitset<8192>;
+	constexpr uint16_t pid_mask = 0x1FFF;
+
+	// The decoders below are templated on the reader, so the concrete readers are called directly and
+	// can be inlined; IReader can still be passed as a type-erased fallback.
+
+	template<typename Reader>
+	void read_lang_code(Reader& reader, BDParser::stream_t& s, std::error_code& ec)
+	{
+		reader.read_buffer(s.lang_code.data(), s.lang_code.size(), ec);
+	}
+
+	// Stream coding info shared by the STN table of playlists and the program info of clips, after its length
+	template<typename Reader>
+	[[nodiscard]] bool read_stream_coding_info(Reader& reader, BDParser::stream_t& s)
+	{
+		std::error_code ec = {};
+		s.type = static_cast<decltype(s.type)>(reader.read_uint8(ec));
+		if (ec) {
+			return false;
+		}
+
+		switch (s.type) {
+			case StreamType::MPEG1_VIDEO:
+			case StreamType::MPEG2_VIDEO:
+			case StreamType::H264_VIDEO:
+			case StreamType::H264_MVC_VIDEO:
+			case StreamType::HEVC_VIDEO:
+			case StreamType::VC1_VIDEO:
+				{
+					auto value = reader.read_uint8(ec);
+					s.video_format = static_cast<decltype(s.video_format)>(value >> 4);
+					s.frame_rate = static_cast<decltype(s.frame_rate)>(value & 0xf);
+				}
+				break;
+			case StreamType::MPEG1_AUDIO:
+			case StreamType::MPEG2_AUDIO:
+			case StreamType::LPCM_AUDIO:
+			case StreamType::AC3_AUDIO:
+			case StreamType::DTS_AUDIO:
+			case StreamType::AC3_TRUE_HD_AUDIO:
+			case StreamType::AC3_PLUS_AUDIO:
+			case StreamType::DTS_HD_AUDIO:
+			case StreamType::DTS_HD_MASTER_AUDIO:
+			case StreamType::AC3_PLUS_SECONDARY_AUDIO:
+			case StreamType::DTS_HD_SECONDARY_AUDIO:
+				{
+					auto value = reader.read_uint8(ec);
+					s.channel_layout = static_cast<decltype(s.channel_layout)>(value >> 4);
+					s.sample_rate = static_cast<decltype(s.sample_rate)>(value & 0xf);
+					read_lang_code(reader, s, ec);
+				}
+				break;
+			case StreamType::PRESENTATION_GRAPHICS:
+			case StreamType::INTERACTIVE_GRAPHICS:
+				read_lang_code(reader, s, ec);
+				break;
+			case StreamType::SUBTITLE:
+				reader.skip(1, ec);
+				read_lang_code(reader, s, ec);
+				break;
+			default:
+				break;
+		}
+
+		return !ec;
+	}
+
+	template<typename Reader>
+	[[nodiscard]] bool read_stream_info(Reader& reader, std::vector<BDParser::stream_t>& streams, pid_set_t& pids)
+	{
+		std::error_code ec = {};
+		auto size = reader.read_uint8(ec);
+		auto pos = reader.position(ec);
+
+		auto stream_type = reader.read_uint8(ec);
+		if (ec) {
+			return false;
+		}
+
+		BDParser::stream_t s;
+
+		switch (stream_type) {
+			case 1:
+				s.pid = reader.read_uint16(ec);
+				break;
+			case 2:
+			case 4:
+				reader.skip(2, ec);
+				s.pid = reader.read_uint16(ec);
+				break;
+			case 3:
+				reader.skip(1, ec);
+				s.pid = reader.read_uint16(ec);
+				break;
+			default:
+				return false;
+		}
+
+		reader.seek(pos + size, ec);
+		size = reader.read_uint8(ec);
+		pos = reader.position(ec);
+		if (ec) {
+			return false;
+		}
+
+		if (pids[s.pid & pid_mask]) {
+			reader.seek(pos + size, ec);
+			return true;
+		}
+
+		if (!read_stream_coding_info(reader, s)) {
+			return false;
+		}
+
+		pids.set(s.pid & pid_mask);
+		streams.emplace_back(s);
+
+		reader.seek(pos + size, ec);
+
+		return true;
+	}
+
+	template<typename Reader>
+	[[nodiscard]] bool read_stn_info(Reader& reader, std::vector<BDParser::stream_t>& streams, pid_set_t& pids)
+	{
+		std::error_code ec = {};
+		reader.skip(4, ec);
+
+		auto num_video = reader.read_uint8(ec);
+		auto num_audio = reader.read_uint8(ec);
+		auto num_pg = reader.read_uint8(ec);
+		auto num_ig = reader.read_uint8(ec);
+		auto num_secondary_audio = reader.read_uint8(ec);
+		auto num_secondary_video = reader.read_uint8(ec);
+		auto num_pip_pg = reader.read_uint8(ec);
+
+		if (ec) {
+			return false;
+		}
+
+		reader.skip(5, ec);
+
+		if (streams.empty()) {
+			streams.reserve(static_cast<size_t>(num_video) + num_audio + num_pg + num_ig +
+							num_secondary_audio + num_secondary_video + num_pip_pg);
+		}
+
+		for (uint8_t i = 0; i < num_video; i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+		}
+
+		for (uint8_t i = 0; i < num_audio; i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+		}
+
+		for (uint8_t i = 0; i < (num_pg + num_pip_pg); i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+		}
+
+		for (uint8_t i = 0; i < num_ig; i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+		}
+
+		for (uint8_t i = 0; i < num_secondary_audio; i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+
+			// Secondary Audio Extra Attributes
+			const auto num_secondary_audio_extra = reader.read_uint8(ec);
+			reader.skip(1, ec);
+			if (num_secondary_audio_extra) {
+				reader.skip(num_secondary_audio_extra, ec);
+				if (num_secondary_audio_extra % 2) {
+					reader.skip(1, ec);
+				}
+			}
+
+			if (ec) {
+				return false;
+			}
+		}
+
+		for (uint8_t i = 0; i < num_secondary_video; i++) {
+			if (!(read_stream_info(reader, streams, pids))) {
+				return false;
+			}
+
+			// Secondary Video Extra Attributes
+			const auto num_secondary_video_extra = reader.read_uint8(ec);
+			reader.skip(1, ec);
+			if (num_secondary_video_extra) {
+				reader.skip(num_secondary_video_extra, ec);
+				if (num_secondary_video_extra % 2) {
+					reader.skip(1, ec);
+				}
+			}
+
+			const auto num_pip_pg_extra = reader.read_uint8(ec);
+			reader.skip(1, ec);
+			if (num_pip_pg_extra) {
+				reader.skip(num_pip_pg_extra, ec);
+				if (num_pip_pg_extra % 2) {
+					reader.skip(1, ec);
+				}
+			}
+
+			if (ec) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Clip names are five decimal digits
+	[[nodiscard]] inline bool read_clip_id(const char* name, uint32_t& clip_id) noexcept
+	{
+		clip_id = {};
+		for (int i = 0; i < 5; i++) {
+			if (name[i] < '0' || name[i] > '9') {
+				return false;
+			}
+			clip_id = clip_id * 10 + (name[i] - '0');
+		}
+
+		return true;
+	}
+
+	// 45 kHz ticks to 100 ns units
+	[[nodiscard]] inline pts_t to_pts(uint32_t time) noexcept
+	{
+		return static_cast<pts_t>(20000.0 * time / 90);
+	}
+
+	#define check_version() (!(std::memcmp(buffer, "0300", 4)) || (!std::memcmp(buffer, "0200", 4)) || (!std::memcmp(buffer, "0100", 4)))
+
+	template<typename Reader>
+	[[nodiscard]] bool read_playlist_marks(Reader& reader, uint32_t playlist_mark_start_address, BDParser::playlist_t& playlist)
+	{
+		std::error_code ec = {};
+		reader.seek(playlist_mark_start_address, ec);
+		reader.skip(4, ec);
+		const auto number_of_marks = reader.read_uint16(ec);
+		if (ec) {
+			return false;
+		}
+
+		playlist.marks.reserve(number_of_marks);
+		for (uint16_t i = 0; i < number_of_marks; i++) {
+			reader.skip(1, ec);
+			const auto type = reader.read_uint8(ec);
+			const auto item_index = reader.read_uint16(ec);
+			const auto time = to_pts(reader.read_uint32(ec));
+			// Entry ES PID and duration
+			reader.skip(6, ec);
+			if (ec) {
+				return false;
+			}
+
+			if (item_index >= playlist.items.size()) {
+				continue;
+			}
+
+			// Mark times are clip times of the item they point into
+			const auto& item = playlist.items[item_index];
+			BDParser::mark_t mark;
+			mark.time = item.start_time + (time > item.start_pts ? time - item.start_pts : 0);
+			mark.item_index = item_index;
+			mark.type = static_cast<MarkType>(type);
+			playlist.marks.emplace_back(mark);
+		}
+
+		std::stable_sort(playlist.marks.begin(), playlist.marks.end(), [](const auto& a, const auto& b) {
+			return a.time < b.time;
+		});
+
+		return true;
+	}
+
+	template<typename Reader>
+	[[nodiscard]] bool read_playlist(Reader& reader, const std::shared_ptr<const std::string>& root_path, const BDParser::options_t& options, BDParser::playlist_t& playlist)
+	{
+		std::error_code ec = {};
+
+		char buffer[9] = {};
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || std::memcmp(buffer, "MPLS", 4)) {
+			return false;
+		}
+
+		reader.read_buffer(buffer, 4, ec);
+		if (ec || !check_version()) {
+			return false;
+		}
+
+		auto playlist_start_address = reader.read_uint32(ec);
+		const auto playlist_mark_start_address = reader.read_uint32(ec);
+		if (ec) {
+			return false;
+		}
+
+		reader.seek(playlist_start_address, ec);
+		reader.skip(6, ec);
+		auto number_of_playlist_items = reader.read_uint16(ec);
+		if (ec) {
+			return false;
+		}
+
+		if (options.min_duration) {
+			// Sum the item times first, so short playlists are dropped before anything is allocated
+			pts_t duration = {};
+			auto item_address = playlist_start_address + 10;
+			for (uint16_t i = 0; i < number_of_playlist_items; i++) {
+				reader.seek(item_address, ec);
+				item_address += reader.read_uint16(ec) + 2;
+				reader.skip(12, ec);
+				const auto start_pts = to_pts(reader.read_uint32(ec));
+				const auto end_pts = to_pts(reader.read_uint32(ec));
+				if (ec) {
+					return false;
+				}
+
+				duration += (end_pts - start_pts);
+			}
+
+			if (duration < options.min_duration) {
+				return false;
+			}
+		}
+
+		playlist.items.reserve(number_of_playlist_items);
+		playlist.item_start_times.reserve(number_of_playlist_items);
+		pid_set_t pids;
+
+		playlist_start_address += 10;
+		for (uint16_t i = 0; i < number_of_playlist_items; i++) {
+			reader.seek(playlist_start_address, ec);
+			playlist_start_address += reader.read_uint16(ec) + 2;
+			reader.read_buffer(buffer, 9, ec);
+			if (ec || std::memcmp(&buffer[5], "M2TS", 4)) {
+				return false;
+			}
+
+			BDParser::playlist_item_t item;
+			item.root_path = root_path;
+			if (!read_clip_id(buffer, item.clip_id)) {
+				return false;
+			}
+			if (std::find_if(playlist.items.begin(), playlist.items.end(), [&](const auto& _item) {
+						return item.clip_id == _item.clip_id;
+					}) != playlist.items.end()) {
+				// Ignore playlists with duplicate files
+				return false;
+			}
+
+			reader.read_buffer(buffer, 3, ec);
+			if (ec) {
+				return false;
+			}
+			bool multi_angle = (buffer[1] >> 4) & 0x1;
+			item.start_pts = to_pts(reader.read_uint32(ec));
+			item.end_pts = to_pts(reader.read_uint32(ec));
+			if (ec) {
+				return false;
+			}
+
+			item.start_time = playlist.duration;
+			playlist.duration += (item.end_pts - item.start_pts);
+			playlist.item_start_times.push_back(item.start_time);
+
+			reader.skip(12, ec);
+			uint8_t angle_count = 1;
+			if (multi_angle) {
+				angle_count = reader.read_uint8(ec);
+				if (angle_count < 1) {
+					angle_count = 1;
+				}
+				reader.skip(1, ec);
+			}
+
+			item.first_angle = static_cast<uint16_t>(playlist.angle_clip_ids.size());
+			for (uint8_t j = 1; j < angle_count; j++) {
+				// Clip name, codec identifier and STC id, checked like the clip of the first angle so that
+				// a bad entry can't shift the angles after it
+				reader.read_buffer(buffer, 9, ec);
+				reader.skip(1, ec);
+				if (ec || std::memcmp(&buffer[5], "M2TS", 4)) {
+					return false;
+				}
+
+				uint32_t angle_clip_id = {};
+				if (!read_clip_id(buffer, angle_clip_id)) {
+					return false;
+				}
+				playlist.angle_clip_ids.push_back(angle_clip_id);
+				item.angle_count++;
+			}
+
+			if (options.summary_only) {
+				// Items are addressed by their length, so the rest of the item including the STN table is skipped
+				playlist.items.emplace_back(std::move(item));
+				continue;
+			}
+
+			if (!read_stn_info(reader, playlist.streams, pids)) {
+				return false;
+			}
+
+			playlist.items.emplace_back(std::move(item));
+		}
+
+		// Marks were ignored before, so a broken mark table only loses the chapters
+		if (!read_playlist_marks(reader, playlist_mark_start_address, playlist)) {
+			playlist.marks.clear();
+		}
+
+		playlist.summary = options.summary_only;
+
+		return playlist.duration != 0;
+	}
+
+	// Numbered disc files are five decimal digits and an extension, matched case-insensitively
+	[[nodiscard]] inline bool read_file_number(std::string_view name, std::string_view extension, uint32_t& number) noexcept
+	{
+		if (name.size() != 5 + extension.size()) {
+			return false;
+		}
+
+		for (std::size_t i = 0; i < extension.size(); i++) {
+			auto c = name[5 + i];
+			if (c >= 'A' && c <= 'Z') {
+				c = static_cast<char>(c - 'A' + 'a');
+			}
+			if (c != extension[i]) {
+				return false;
+			}
+		}
+
+		return read_clip_id(name.data(), number);
+	}
+
+	// Calls func(number, name) for every numbered file of a directory with the given lower case extension.
+	// The entry type comes from the directory listing itself, no entry is stat'ed and no path is built.
+	template<typename Func>
+	[[nodiscard]] bool list_numbered_files(const std::filesystem::path& path, std::string_view extension, Func&& func)
+	{
+		uint32_t number = {};
+
+#ifdef _WIN32
+		WIN32_FIND_DATAW data = {};
+		auto handle = FindFirstFileExW((path / L"*").c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+		if (handle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		do {
+			if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				continue;
+			}
+
+			// Names of interest are ASCII, anything longer or wider can't match
+			char name[16] = {};
+			std::size_t size = {};
+			for (; data.cFileName[size] && size < sizeof(name); size++) {
+				if (data.cFileName[size] > 0x7F) {
+					break;
+				}
+				name[size] = static_cast<char>(data.cFileName[size]);
+			}
+
+			if (!data.cFileName[size] && read_file_number({ name, size }, extension, number)) {
+				func(number, std::string_view(name, size));
+			}
+		} while (FindNextFileW(handle, &data));
+
+		FindClose(handle);
+#else
+		auto dir = opendir(path.c_str());
+		if (!dir) {
+			return false;
+		}
+
+		while (auto entry = readdir(dir)) {
+			// Without type information the entry is taken, reading it fails later if it isn't a file
+			if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+				continue;
+			}
+
+			const std::string_view name(entry->d_name);
+			if (read_file_number(name, extension, number)) {
+				func(number, name);
+			}
+		}
+
+		closedir(dir);
+#endif
+
+		return true;
+	}
+
+	struct playlist_file_t {
+		uint32_t playlist_id;
+		std::string path;
+	};
+
+	[[nodiscard]] inline bool collect_playlists(const std::string& path, std::vector<playlist_file_t>& playlist_files)
+	{
+		constexpr std::string_view check_paths[] = {
+			"index.bdmv",
+			"CLIPINF",
+			"PLAYLIST",
+			"STREAM"
+		};
+
+		// Checking required paths
+		std::error_code ec = {};
+		for (auto& check_path : check_paths) {
+			if (!std::filesystem::exists(path / std::filesystem::path(check_path), ec)) {
+				return false;
+			}
+		}
+
+		// Collect playlists, sorted so that duplicate elimination doesn't depend on the directory order
+		std::filesystem::path playlist_path = path / std::filesystem::path("PLAYLIST");
+		if (!list_numbered_files(playlist_path, ".mpls", [&](uint32_t playlist_id, std::string_view name) {
+					playlist_files.push_back({ playlist_id, (playlist_path / name).string() });
+				})) {
+			return false;
+		}
+
+		std::sort(playlist_files.begin(), playlist_files.end(), [](const auto& a, const auto& b) {
+			return std::tie(a.playlist_id, a.path) < std::tie(b.playlist_id, b.path);
+		});
+
+		return true;
+	}
+} // namespace parser
+
+#endif // BDPARSER_DECODERS_HPP